@@ -1,38 +1,217 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome import pins
-from esphome.components import display, spi
+import esphome.final_validate as fv
+from esphome import automation, pins
+from esphome.components import display, font, sensor, spi
 from esphome.const import (
     CONF_DC_PIN,
     CONF_ID,
     CONF_LAMBDA,
+    CONF_MODEL,
     CONF_PAGES,
     CONF_RESET_PIN,
     CONF_BUSY_PIN,
+    CONF_FULL_UPDATE_EVERY,
+    CONF_ROTATION,
+    CONF_SPI_ID,
 )
 
 DEPENDENCIES = ["spi"]
 
+CONF_BUSY_INTERRUPT = "busy_interrupt"
+CONF_RED_RAM_WRITE_ONCE = "red_ram_write_once"
+CONF_REFRESH_MODE = "refresh_mode"
+CONF_DIRTY_TRACKING = "dirty_tracking"
+CONF_SKIP_UNCHANGED = "skip_unchanged"
+CONF_PERSISTENT_INIT = "persistent_init"
+CONF_NATIVE_POLARITY = "native_polarity"
+CONF_HARDWARE_ROTATION = "hardware_rotation"
+CONF_LOW_POWER = "low_power"
+CONF_CUT_PANEL_POWER = "cut_panel_power"
+CONF_DIAGNOSTICS = "diagnostics"
+CONF_ADAPTIVE_TIMEOUT = "adaptive_timeout"
+CONF_WAVEFORM_CACHE = "waveform_cache"
+CONF_WAVEFORM = "waveform"
+CONF_GRAYSCALE = "grayscale"
+CONF_WORKER_TASK = "worker_task"
+CONF_ITERATIONS = "iterations"
+CONF_REFRESHES = "refreshes"
+CONF_FONT = "font"
+CONF_TEMPERATURE_SENSOR = "temperature_sensor"
+CONF_MIN_REFRESH_INTERVAL = "min_refresh_interval"
+CONF_BUFFER_LOCATION = "buffer_location"
+CONF_SHADOW_BUFFER_LOCATION = "shadow_buffer_location"
+
 ssd1680_epaper_ns = cg.esphome_ns.namespace("ssd1680_epaper")
 SSD1680EPaper = ssd1680_epaper_ns.class_(
     "SSD1680EPaper", cg.PollingComponent, display.DisplayBuffer, spi.SPIDevice
 )
+BenchmarkAction = ssd1680_epaper_ns.class_("BenchmarkAction", automation.Action)
+
+RefreshMode = ssd1680_epaper_ns.enum("RefreshMode")
+REFRESH_MODES = {
+    "full": RefreshMode.REFRESH_MODE_FULL,
+    "partial": RefreshMode.REFRESH_MODE_PARTIAL,
+}
+
+Waveform = ssd1680_epaper_ns.enum("Waveform")
+WAVEFORMS = {
+    "otp": Waveform.WAVEFORM_OTP,
+    "full": Waveform.WAVEFORM_FULL,
+    "gray4": Waveform.WAVEFORM_GRAY4,
+}
+
+BufferLocation = ssd1680_epaper_ns.enum("BufferLocation")
+BUFFER_LOCATIONS = {
+    "auto": BufferLocation.BUFFER_LOCATION_AUTO,
+    "internal": BufferLocation.BUFFER_LOCATION_INTERNAL,
+    "psram": BufferLocation.BUFFER_LOCATION_PSRAM,
+}
+
+PanelModel = ssd1680_epaper_ns.enum("PanelModel")
+MODELS = {
+    "2.90in": PanelModel.PANEL_MODEL_2_90IN,
+    "2.13in": PanelModel.PANEL_MODEL_2_13IN,
+    "2.66in": PanelModel.PANEL_MODEL_2_66IN,
+}
+
+
+def _validate_hardware_rotation(config):
+    # A RAM byte always spans 8 source pixels, so the controller can only
+    # mirror both axes (180 degrees), never swap them
+    if config[CONF_HARDWARE_ROTATION] and config.get(CONF_ROTATION, 0) in (90, 270):
+        raise cv.Invalid(
+            f"{CONF_HARDWARE_ROTATION} only supports rotation 0 or 180, "
+            "use software rotation for 90/270"
+        )
+    return config
+
+
+def _validate_low_power(config):
+    if config[CONF_CUT_PANEL_POWER] and not config[CONF_LOW_POWER]:
+        raise cv.Invalid(f"{CONF_CUT_PANEL_POWER} requires {CONF_LOW_POWER}")
+    # Deep sleep mode 1 is only left through a hardware reset, unless the
+    # panel supply is cut as well and the controller starts from power-on
+    if config[CONF_LOW_POWER] and CONF_RESET_PIN not in config and not config[CONF_CUT_PANEL_POWER]:
+        raise cv.Invalid(f"{CONF_LOW_POWER} requires {CONF_RESET_PIN} (or {CONF_CUT_PANEL_POWER})")
+    return config
+
+
+def _validate_waveform_cache(config):
+    # Every reset reloads the OTP waveform, so the cache only survives between
+    # frames when the controller isn't reset (or put into deep sleep) each time
+    if not config[CONF_WAVEFORM_CACHE]:
+        return config
+    if not config[CONF_PERSISTENT_INIT]:
+        raise cv.Invalid(f"{CONF_WAVEFORM_CACHE} requires {CONF_PERSISTENT_INIT}")
+    if config[CONF_LOW_POWER]:
+        raise cv.Invalid(f"{CONF_WAVEFORM_CACHE} is not supported with {CONF_LOW_POWER}")
+    return config
+
+
+def _validate_grayscale(config):
+    # Both RAM planes carry the 2-bpp frame, so there is no reference plane
+    # for partial refreshes and no 1-bpp shadow to diff against. The other
+    # way round, gray4 only makes sense with the high bit in the RED plane.
+    if not config[CONF_GRAYSCALE]:
+        if config[CONF_WAVEFORM] == "gray4":
+            raise cv.Invalid(f"{CONF_WAVEFORM}: gray4 requires {CONF_GRAYSCALE}: true")
+        return config
+    if config[CONF_WAVEFORM] != "gray4":
+        raise cv.Invalid(f"{CONF_GRAYSCALE} requires {CONF_WAVEFORM}: gray4")
+    if config[CONF_REFRESH_MODE] != "full":
+        raise cv.Invalid(f"{CONF_GRAYSCALE} requires {CONF_REFRESH_MODE}: full")
+    for option in (CONF_DIRTY_TRACKING, CONF_NATIVE_POLARITY):
+        if config[option]:
+            raise cv.Invalid(f"{option} is not supported with {CONF_GRAYSCALE}")
+    return config
 
-CONFIG_SCHEMA = (
+
+def _spi_devices(node):
+    # Every component config (at any depth) that sits on an SPI bus
+    if isinstance(node, dict):
+        if CONF_SPI_ID in node:
+            yield node
+        for value in node.values():
+            yield from _spi_devices(value)
+    elif isinstance(node, list):
+        for item in node:
+            yield from _spi_devices(item)
+
+
+def _final_validate_worker_task(config):
+    # The worker task runs SPI transactions from another core, which would
+    # interleave with the main loop's transactions on a shared bus
+    if not config[CONF_WORKER_TASK]:
+        return config
+    for device in _spi_devices(fv.full_config.get()):
+        if device.get(CONF_ID) == config[CONF_ID]:
+            continue
+        if device[CONF_SPI_ID] == config[CONF_SPI_ID]:
+            raise cv.Invalid(
+                f"{CONF_WORKER_TASK} needs an SPI bus of its own, "
+                f"{device.get(CONF_ID, 'another device')} is also on {config[CONF_SPI_ID]}"
+            )
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
     display.FULL_DISPLAY_SCHEMA.extend(
         {
             cv.GenerateID(): cv.declare_id(SSD1680EPaper),
+            cv.Optional(CONF_MODEL, default="2.90in"): cv.enum(MODELS, lower=True),
             cv.Required(CONF_DC_PIN): pins.gpio_output_pin_schema,
             cv.Optional(CONF_RESET_PIN): pins.gpio_output_pin_schema,
             cv.Optional(CONF_BUSY_PIN): pins.gpio_input_pin_schema,
+            cv.Optional(CONF_BUSY_INTERRUPT, default=False): cv.boolean,
+            cv.Optional(CONF_RED_RAM_WRITE_ONCE, default=False): cv.boolean,
+            cv.Optional(CONF_REFRESH_MODE, default="full"): cv.enum(
+                REFRESH_MODES, lower=True
+            ),
+            cv.Optional(CONF_FULL_UPDATE_EVERY, default=30): cv.int_range(
+                min=1, max=4294967295
+            ),
+            cv.Optional(
+                CONF_MIN_REFRESH_INTERVAL, default="0ms"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_DIRTY_TRACKING, default=False): cv.boolean,
+            cv.Optional(CONF_BUFFER_LOCATION, default="auto"): cv.enum(
+                BUFFER_LOCATIONS, lower=True
+            ),
+            cv.Optional(CONF_SHADOW_BUFFER_LOCATION, default="auto"): cv.enum(
+                BUFFER_LOCATIONS, lower=True
+            ),
+            cv.Optional(CONF_SKIP_UNCHANGED, default=False): cv.boolean,
+            cv.Optional(CONF_PERSISTENT_INIT, default=False): cv.boolean,
+            cv.Optional(CONF_NATIVE_POLARITY, default=False): cv.boolean,
+            cv.Optional(CONF_HARDWARE_ROTATION, default=False): cv.boolean,
+            cv.Optional(CONF_LOW_POWER, default=False): cv.boolean,
+            cv.Optional(CONF_CUT_PANEL_POWER, default=False): cv.boolean,
+            cv.Optional(CONF_DIAGNOSTICS, default=False): cv.boolean,
+            cv.Optional(CONF_WORKER_TASK, default=False): cv.boolean,
+            cv.Optional(CONF_ADAPTIVE_TIMEOUT, default=False): cv.boolean,
+            cv.Optional(CONF_WAVEFORM, default="otp"): cv.enum(WAVEFORMS, lower=True),
+            cv.Optional(CONF_GRAYSCALE, default=False): cv.boolean,
+            cv.Optional(CONF_WAVEFORM_CACHE, default=False): cv.boolean,
+            cv.Optional(CONF_TEMPERATURE_SENSOR): cv.use_id(sensor.Sensor),
         }
     )
     .extend(cv.polling_component_schema("60s"))
-    .extend(spi.spi_device_schema(cs_pin_required=True))
+    .extend(spi.spi_device_schema(cs_pin_required=True, default_data_rate=4e6)),
+    _validate_hardware_rotation,
+    _validate_low_power,
+    _validate_waveform_cache,
+    _validate_grayscale,
 )
 
 
+FINAL_VALIDATE_SCHEMA = _final_validate_worker_task
+
+
 async def to_code(config):
+    # The panel geometry is a compile-time constant, so bounds checks and
+    # row offsets fold into the generated code
+    cg.add_define("SSD1680_EPAPER_MODEL", config[CONF_MODEL])
     var = cg.new_Pvariable(config[CONF_ID])
     await display.register_display(var, config)
     await spi.register_spi_device(var, config)
@@ -47,9 +226,67 @@ async def to_code(config):
     if CONF_BUSY_PIN in config:
         busy = await cg.gpio_pin_expression(config[CONF_BUSY_PIN])
         cg.add(var.set_busy_pin(busy))
+        cg.add(var.set_busy_interrupt(config[CONF_BUSY_INTERRUPT]))
+
+    cg.add(var.set_red_ram_write_once(config[CONF_RED_RAM_WRITE_ONCE]))
+    cg.add(var.set_refresh_mode(config[CONF_REFRESH_MODE]))
+    cg.add(var.set_full_update_every(config[CONF_FULL_UPDATE_EVERY]))
+    cg.add(var.set_min_refresh_interval(config[CONF_MIN_REFRESH_INTERVAL]))
+    cg.add(var.set_dirty_tracking(config[CONF_DIRTY_TRACKING]))
+    cg.add(var.set_buffer_location(config[CONF_BUFFER_LOCATION]))
+    cg.add(var.set_shadow_buffer_location(config[CONF_SHADOW_BUFFER_LOCATION]))
+    cg.add(var.set_skip_unchanged(config[CONF_SKIP_UNCHANGED]))
+    cg.add(var.set_persistent_init(config[CONF_PERSISTENT_INIT]))
+    cg.add(var.set_native_polarity(config[CONF_NATIVE_POLARITY]))
+    cg.add(var.set_hardware_rotation(config[CONF_HARDWARE_ROTATION]))
+    cg.add(var.set_low_power(config[CONF_LOW_POWER]))
+    cg.add(var.set_cut_panel_power(config[CONF_CUT_PANEL_POWER]))
+    cg.add(var.set_diagnostics(config[CONF_DIAGNOSTICS]))
+    cg.add(var.set_adaptive_timeout(config[CONF_ADAPTIVE_TIMEOUT]))
+    cg.add(var.set_waveform(config[CONF_WAVEFORM]))
+    cg.add(var.set_grayscale(config[CONF_GRAYSCALE]))
+    cg.add(var.set_waveform_cache(config[CONF_WAVEFORM_CACHE]))
+    if CONF_TEMPERATURE_SENSOR in config:
+        temperature = await cg.get_variable(config[CONF_TEMPERATURE_SENSOR])
+        cg.add(var.set_temperature_sensor(temperature))
+    if config[CONF_LOW_POWER]:
+        # Reserves a frame of RTC memory for the wake-up reference
+        cg.add_define("SSD1680_EPAPER_RTC_FRAME")
+    if config[CONF_WORKER_TASK]:
+        cg.add_define("SSD1680_EPAPER_WORKER_TASK")
+        cg.add(var.set_worker_task(True))
 
     if CONF_LAMBDA in config:
         lambda_ = await cg.process_lambda(
             config[CONF_LAMBDA], [(display.DisplayRef, "it")], return_type=cg.void
         )
         cg.add(var.set_writer(lambda_))
+
+
+@automation.register_action(
+    "ssd1680_epaper.benchmark",
+    BenchmarkAction,
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.use_id(SSD1680EPaper),
+            cv.Optional(CONF_ITERATIONS, default=10): cv.templatable(
+                cv.int_range(min=1, max=1000)
+            ),
+            cv.Optional(CONF_REFRESHES, default=1): cv.templatable(
+                cv.int_range(min=0, max=10)
+            ),
+            cv.Optional(CONF_FONT): cv.use_id(font.Font),
+        }
+    ),
+)
+async def benchmark_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    iterations = await cg.templatable(config[CONF_ITERATIONS], args, cg.uint32)
+    cg.add(var.set_iterations(iterations))
+    refreshes = await cg.templatable(config[CONF_REFRESHES], args, cg.uint32)
+    cg.add(var.set_refreshes(refreshes))
+    if CONF_FONT in config:
+        font_ = await cg.get_variable(config[CONF_FONT])
+        cg.add(var.set_font(font_))
+    return var
@@ -0,0 +1,516 @@
+#include "frame_ops.h"
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace ssd1680_epaper {
+
+// Bytes an extra RAM window costs in commands (0x44/0x45/0x4E/0x4F and the
+// write command), bands of rows closer than that are sent as one window
+static const uint32_t REGION_OVERHEAD_BYTES = 16;
+
+RamWindow window_union(const RamWindow &a, const RamWindow &b) {
+  return {std::min(a.x_start, b.x_start), std::max(a.x_end, b.x_end), std::min(a.y_start, b.y_start),
+          std::max(a.y_end, b.y_end)};
+}
+
+// Hacker's Delight transpose8
+void to_absolute_rect(int rotation, uint16_t width, uint16_t height, int x0, int y0, int x1, int y1, int *ax0,
+                      int *ay0, int *ax1, int *ay1) {
+  // Input is exclusive at x1/y1, output inclusive
+  const int w = width;
+  const int h = height;
+  switch (rotation) {
+    case 90:
+      *ax0 = w - y1;
+      *ax1 = w - 1 - y0;
+      *ay0 = x0;
+      *ay1 = x1 - 1;
+      break;
+    case 180:
+      *ax0 = w - x1;
+      *ax1 = w - 1 - x0;
+      *ay0 = h - y1;
+      *ay1 = h - 1 - y0;
+      break;
+    case 270:
+      *ax0 = y0;
+      *ax1 = y1 - 1;
+      *ay0 = h - x1;
+      *ay1 = h - 1 - x0;
+      break;
+    default:
+      *ax0 = x0;
+      *ax1 = x1 - 1;
+      *ay0 = y0;
+      *ay1 = y1 - 1;
+      break;
+  }
+}
+
+void fill_rect_absolute(uint8_t *buffer, uint8_t row_bytes, int x0, int y0, int x1, int y1, bool set) {
+  const int xb0 = x0 / 8;
+  const int xb1 = x1 / 8;
+  const uint8_t first_mask = 0xFF >> (x0 % 8);
+  const uint8_t last_mask = 0xFF << (7 - (x1 % 8));
+  const uint8_t value = set ? 0xFF : 0x00;
+  
+  for (int y = y0; y <= y1; y++) {
+    uint8_t *row = buffer + y * row_bytes;
+    if (xb0 == xb1) {
+      uint8_t mask = first_mask & last_mask;
+      row[xb0] = set ? (row[xb0] | mask) : (row[xb0] & ~mask);
+      continue;
+    }
+    row[xb0] = set ? (row[xb0] | first_mask) : (row[xb0] & ~first_mask);
+    if (xb1 - xb0 > 1) {
+      memset(row + xb0 + 1, value, xb1 - xb0 - 1);
+    }
+    row[xb1] = set ? (row[xb1] | last_mask) : (row[xb1] & ~last_mask);
+  }
+}
+
+void write_bits(uint8_t *buffer, uint8_t row_bytes, int x, int y, uint8_t bits, uint8_t mask, bool set,
+                bool transparent) {
+  uint8_t *row = buffer + y * row_bytes;
+  int byte = x >> 3;  // arithmetic shift, floors negative x
+  int shift = x & 7;
+  
+  uint8_t value = set ? bits : static_cast<uint8_t>(~bits);
+  uint8_t write_mask = transparent ? (bits & mask) : mask;
+  uint8_t hi_mask = write_mask >> shift;
+  uint8_t lo_mask = shift == 0 ? 0 : static_cast<uint8_t>(write_mask << (8 - shift));
+  if (hi_mask != 0) {
+    row[byte] = (row[byte] & ~hi_mask) | ((value >> shift) & hi_mask);
+  }
+  if (lo_mask != 0) {
+    row[byte + 1] = (row[byte + 1] & ~lo_mask) | ((value << (8 - shift)) & lo_mask);
+  }
+}
+
+void blit_bitmap(uint8_t *buffer, uint8_t row_bytes, uint16_t width, uint16_t height, int rotation, int x, int y,
+                 int bitmap_width, int bitmap_height, const uint8_t *bitmap, bool set, bool transparent) {
+  const int stride = (bitmap_width + 7) / 8;
+  const int w = width;
+  const int h = height;
+  
+  if (rotation == 0 || rotation == 180) {
+    // Bitmap rows stay panel rows, 180 mirrors them bytewise
+    const bool flip = rotation == 180;
+    for (int r = 0; r < bitmap_height; r++) {
+      const uint8_t *src = bitmap + r * stride;
+      int py = flip ? h - 1 - (y + r) : y + r;
+      for (int i = 0; i < stride; i++) {
+        int valid = std::min(8, bitmap_width - i * 8);
+        uint8_t mask = 0xFF << (8 - valid);
+        if (flip) {
+          write_bits(buffer, row_bytes, w - 8 - x - i * 8, py, reverse_bits(src[i]), reverse_bits(mask), set,
+                     transparent);
+        } else {
+          write_bits(buffer, row_bytes, x + i * 8, py, src[i], mask, set, transparent);
+        }
+      }
+    }
+    return;
+  }
+  
+  // 90/270: bitmap rows become panel columns. Each 8x8 tile is transposed in
+  // one go so a whole panel byte is written per tile row.
+  const bool cw = rotation == 90;
+  uint8_t in[8];
+  uint8_t out[8];
+  for (int r0 = 0; r0 < bitmap_height; r0 += 8) {
+    int rows = std::min(8, bitmap_height - r0);
+    // 90 puts the last bitmap row leftmost, 270 the first one
+    uint8_t mask = cw ? (0xFF >> (8 - rows)) : static_cast<uint8_t>(0xFF << (8 - rows));
+    int px = cw ? w - 8 - y - r0 : y + r0;
+    for (int i = 0; i < stride; i++) {
+      for (int j = 0; j < 8; j++) {
+        uint8_t b = j < rows ? bitmap[(r0 + j) * stride + i] : 0;
+        in[cw ? 7 - j : j] = b;
+      }
+      transpose8(in, out);
+      int cols = std::min(8, bitmap_width - i * 8);
+      for (int k = 0; k < cols; k++) {
+        int lx = x + i * 8 + k;
+        int py = cw ? lx : h - 1 - lx;
+        write_bits(buffer, row_bytes, px, py, out[k], mask, set, transparent);
+      }
+    }
+  }
+}
+
+void transpose8(const uint8_t *in, uint8_t *out) {
+  uint32_t x = (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) | (uint32_t(in[2]) << 8) | in[3];
+  uint32_t y = (uint32_t(in[4]) << 24) | (uint32_t(in[5]) << 16) | (uint32_t(in[6]) << 8) | in[7];
+  uint32_t t;
+  t = (x ^ (x >> 7)) & 0x00AA00AA;
+  x = x ^ t ^ (t << 7);
+  t = (y ^ (y >> 7)) & 0x00AA00AA;
+  y = y ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC;
+  x = x ^ t ^ (t << 14);
+  t = (y ^ (y >> 14)) & 0x0000CCCC;
+  y = y ^ t ^ (t << 14);
+  t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+  y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+  x = t;
+  out[0] = x >> 24;
+  out[1] = x >> 16;
+  out[2] = x >> 8;
+  out[3] = x;
+  out[4] = y >> 24;
+  out[5] = y >> 16;
+  out[6] = y >> 8;
+  out[7] = y;
+}
+
+uint32_t diff_rows(const uint8_t *cur, const uint8_t *prev, uint8_t row_bytes, uint16_t height,
+                   const RamWindow &dirty, RowSpan *rows, RamWindow *changed) {
+  for (uint16_t y = 0; y < height; y++) {
+    rows[y] = {0xFF, 0x00};
+  }
+  *changed = EMPTY_WINDOW;
+  // Only the rows touched while drawing can differ from the previous frame
+  if (dirty.is_empty())
+    return 0;
+  
+  // The buffers are compared 32 bits at a time. Rows aren't word aligned on
+  // every panel, a word that differs is resolved byte by byte to its row.
+  cur = static_cast<const uint8_t *>(__builtin_assume_aligned(cur, 4));
+  prev = static_cast<const uint8_t *>(__builtin_assume_aligned(prev, 4));
+  const uint32_t end = (uint32_t(dirty.y_end) + 1) * row_bytes;
+  uint32_t offset = uint32_t(dirty.y_start) * row_bytes & ~3UL;
+  uint16_t y = offset / row_bytes;
+  uint32_t row_start = uint32_t(y) * row_bytes;
+  uint32_t count = 0;
+  
+  for (; offset < end; offset += 4) {
+    uint32_t a, b;
+    memcpy(&a, cur + offset, 4);
+    memcpy(&b, prev + offset, 4);
+    if (a == b)
+      continue;
+  
+    for (uint32_t i = offset; i < offset + 4; i++) {
+      if (cur[i] == prev[i])
+        continue;
+      while (i >= row_start + row_bytes) {
+        y++;
+        row_start += row_bytes;
+      }
+      const uint8_t x = i - row_start;
+      RowSpan &span = rows[y];
+      if (x < span.x_start)
+        span.x_start = x;
+      if (x > span.x_end)
+        span.x_end = x;
+  
+      if (x < changed->x_start)
+        changed->x_start = x;
+      if (x > changed->x_end)
+        changed->x_end = x;
+      if (y < changed->y_start)
+        changed->y_start = y;
+      changed->y_end = y;
+      count++;
+    }
+  }
+  return count;
+}
+
+uint8_t split_regions(const RowSpan *rows, const RamWindow &window, RamWindow *regions) {
+  // Consecutive changed rows form a band. Bands are merged while the rows
+  // in between cost less than another window, or while there are too many.
+  RamWindow bands[MAX_FRAME_REGIONS + 1];
+  uint8_t count = 0;
+  for (uint32_t y = window.y_start; y <= window.y_end; y++) {
+    const RowSpan &span = rows[y];
+    if (span.is_empty())
+      continue;
+    const RamWindow row = {span.x_start, span.x_end, uint16_t(y), uint16_t(y)};
+    if (count > 0) {
+      RamWindow &last = bands[count - 1];
+      if (last.y_end + 1u == y || merge_cost(last, row) <= REGION_OVERHEAD_BYTES) {
+        last = window_union(last, row);
+        continue;
+      }
+    }
+    bands[count++] = row;
+  
+    if (count > MAX_FRAME_REGIONS) {
+      uint8_t best = 0;
+      uint32_t best_cost = UINT32_MAX;
+      for (uint8_t i = 0; i + 1 < count; i++) {
+        uint32_t cost = merge_cost(bands[i], bands[i + 1]);
+        if (cost < best_cost) {
+          best = i;
+          best_cost = cost;
+        }
+      }
+      bands[best] = window_union(bands[best], bands[best + 1]);
+      for (uint8_t i = best + 1; i + 1 < count; i++) {
+        bands[i] = bands[i + 1];
+      }
+      count--;
+    }
+  }
+  
+  memcpy(regions, bands, count * sizeof(RamWindow));
+  return count;
+}
+
+void set_ram_window(Transport &transport, const RamWindow &window, uint8_t row_bytes, uint16_t height,
+                    bool rotated) {
+  uint8_t x_start = window.x_start;
+  uint8_t x_end = window.x_end;
+  uint16_t y_start = window.y_start;
+  uint16_t y_end = window.y_end;
+  if (rotated) {
+    x_start = row_bytes - 1 - window.x_start;
+    x_end = row_bytes - 1 - window.x_end;
+    y_start = height - 1 - window.y_start;
+    y_end = height - 1 - window.y_end;
+  }
+  
+  // Set RAM X address
+  const uint8_t x_range[] = {x_start, x_end};
+  transport.command(0x44, x_range, sizeof(x_range));
+  
+  // Set RAM Y address
+  const uint8_t y_range[] = {uint8_t(y_start & 0xFF), uint8_t(y_start >> 8), uint8_t(y_end & 0xFF),
+                             uint8_t(y_end >> 8)};
+  transport.command(0x45, y_range, sizeof(y_range));
+  
+  // Set RAM address counters to the window origin
+  transport.command(0x4E, &x_start, 1);
+  const uint8_t y_counter[] = {uint8_t(y_start & 0xFF), uint8_t(y_start >> 8)};
+  transport.command(0x4F, y_counter, sizeof(y_counter));
+}
+
+void pack_plane_row(uint8_t *out, const uint8_t *row, size_t len, uint8_t invert, bool reversed) {
+  if (reversed) {
+    for (size_t i = 0; i < len; i++) {
+      out[i] = reverse_bits(row[i]) ^ invert;
+    }
+  } else {
+    for (size_t i = 0; i < len; i++) {
+      out[i] = row[i] ^ invert;
+    }
+  }
+}
+
+void pack_gray_row(uint8_t *low, uint8_t *high, const uint8_t *row, size_t len, bool reversed) {
+  if (reversed) {
+    for (size_t i = 0; i < len; i++) {
+      const uint16_t planes = gray_planes(row[2 * i], row[2 * i + 1]);
+      low[i] = reverse_bits(planes & 0xFF);
+      high[i] = reverse_bits(planes >> 8);
+    }
+  } else {
+    for (size_t i = 0; i < len; i++) {
+      const uint16_t planes = gray_planes(row[2 * i], row[2 * i + 1]);
+      low[i] = planes & 0xFF;
+      high[i] = planes >> 8;
+    }
+  }
+}
+
+BusyWait poll_busy(Transport &transport, ControllerState &controller, uint32_t elapsed_ms, uint32_t timeout_ms) {
+  if (!transport.busy())
+    return BUSY_WAIT_DONE;
+  if (elapsed_ms <= timeout_ms)
+    return BUSY_WAIT_PENDING;
+  controller.invalidate();
+  return BUSY_WAIT_TIMEOUT;
+}
+
+void begin_reset(Transport &transport, ControllerState &controller, bool hard) {
+  controller.invalidate();
+  if (hard)
+    transport.reset(true);
+}
+
+void FrameWriter::set_layout(uint8_t row_bytes, uint16_t height, uint8_t *staging, size_t staging_bytes) {
+  this->row_bytes_ = row_bytes;
+  this->height_ = height;
+  this->full_window_ = {0, uint8_t(row_bytes - 1), 0, uint16_t(height - 1)};
+  this->staging_ = staging;
+  this->staging_bytes_ = staging_bytes;
+}
+
+void FrameWriter::set_format(bool native_polarity, bool rotated, bool grayscale) {
+  this->native_polarity_ = native_polarity;
+  this->rotated_ = rotated;
+  this->grayscale_ = grayscale;
+}
+
+void FrameWriter::set_red_ram(bool keep_reference, bool write_once) {
+  this->keep_reference_ = keep_reference;
+  this->write_once_ = write_once;
+}
+
+void FrameWriter::write_frame(ControllerState &controller, const uint8_t *frame, const RamWindow *regions,
+                              uint8_t count, bool partial, const uint8_t *restore) {
+  this->frame_ = frame;
+  this->region_count_ = std::min(count, MAX_FRAME_REGIONS);
+  std::copy(regions, regions + this->region_count_, this->regions_);
+  this->partial_ = partial;
+  this->write_count_ = 0;
+  
+  if (partial && restore != nullptr && controller.red_ram != RED_RAM_PREVIOUS_FRAME) {
+    this->queue_(0x26, this->full_window_, restore);
+    controller.red_ram = RED_RAM_PREVIOUS_FRAME;
+  }
+  
+  // Write B/W RAM (0x24) - INVERT data for correct polarity
+  for (uint8_t i = 0; i < this->region_count_; i++) {
+    this->queue_(0x24, this->regions_[i], frame);
+  }
+  
+  // In grayscale the region writes also fill RED RAM with the high bit plane
+  if (this->grayscale_) {
+    controller.red_ram = RED_RAM_UNKNOWN;
+    this->start_();
+    return;
+  }
+  
+  // Write RED RAM (0x26) - all 0x00 to not interfere
+  // The controller keeps RAM across resets, so in write-once mode the plane
+  // is only cleared again after a power cycle or when it held a reference frame
+  if (!partial && (!this->write_once_ || controller.red_ram != RED_RAM_CLEARED)) {
+    this->queue_(0x26, this->full_window_, nullptr);
+    controller.red_ram = RED_RAM_CLEARED;
+  }
+  
+  this->start_();
+}
+
+void FrameWriter::write_reference(ControllerState &controller) {
+  this->write_count_ = 0;
+  
+  if (this->keep_reference_) {
+    // Mode 2 compares RAM 0x24 against 0x26, so keep the frame that is now on
+    // the panel in 0x26 as the reference for the next partial update. After a
+    // partial update only the changed windows differ from the old reference.
+    if (this->partial_) {
+      for (uint8_t i = 0; i < this->region_count_; i++) {
+        this->queue_(0x26, this->regions_[i], this->frame_);
+      }
+    } else {
+      this->queue_(0x26, this->full_window_, this->frame_);
+    }
+    controller.red_ram = RED_RAM_PREVIOUS_FRAME;
+  }
+  
+  this->start_();
+}
+
+void FrameWriter::write_plane(uint8_t command, const RamWindow &window, const uint8_t *source) {
+  this->write_count_ = 0;
+  this->queue_(command, window, source);
+  this->start_();
+}
+
+void FrameWriter::queue_(uint8_t command, const RamWindow &window, const uint8_t *source) {
+  if (window.is_empty() || this->write_count_ >= MAX_PLANE_WRITES)
+    return;
+  PlaneWrite &write = this->writes_[this->write_count_++];
+  write.command = command;
+  write.window = window;
+  write.source = source;
+}
+
+void FrameWriter::start_() {
+  this->write_index_ = 0;
+  this->write_started_ = false;
+  this->bytes_ = 0;
+}
+
+bool FrameWriter::step(Transport &transport) {
+  // One staging buffer per call, so a frame transfer is spread over several
+  // loop() passes instead of holding the CPU for the whole plane
+  if (this->write_index_ >= this->write_count_)
+    return true;
+  
+  PlaneWrite &write = this->writes_[this->write_index_];
+  const RamWindow &window = write.window;
+  const bool gray = this->grayscale_ && write.source != nullptr;
+  if (!this->write_started_) {
+    // Grayscale sets the window per band of rows, see below
+    if (!gray) {
+      set_ram_window(transport, window, this->row_bytes_, this->height_, this->rotated_);
+      transport.command(write.command, nullptr, 0);
+    }
+    this->write_row_ = window.y_start;
+    this->write_started_ = true;
+  }
+  
+  const size_t row_bytes = window.x_end - window.x_start + 1;
+  size_t fill = 0;
+  if (gray) {
+    // Both planes come out of one pass over the 2-bpp rows, with the
+    // LUT_GRAY4 encoding: 0x24 gets the low bit of the ink level, 0x26 the
+    // high bit. Each half of the staging buffer takes one plane of a band of
+    // rows, which then goes to both RAMs through the same window.
+    const size_t half = this->staging_bytes_ / 2;
+    uint8_t *low = this->staging_;
+    uint8_t *high = this->staging_ + half;
+    RamWindow band = window;
+    band.y_start = this->write_row_;
+    size_t plane_fill = 0;
+    while (this->write_row_ <= window.y_end && plane_fill + row_bytes <= half) {
+      const uint8_t *row = write.source + this->write_row_ * this->row_bytes_ * 2 + window.x_start * 2;
+      pack_gray_row(low + plane_fill, high + plane_fill, row, row_bytes, this->rotated_);
+      plane_fill += row_bytes;
+      this->write_row_++;
+    }
+    band.y_end = this->write_row_ - 1;
+    set_ram_window(transport, band, this->row_bytes_, this->height_, this->rotated_);
+    transport.command(0x24, nullptr, 0);
+    transport.data(low, plane_fill);
+    set_ram_window(transport, band, this->row_bytes_, this->height_, this->rotated_);
+    transport.command(0x26, nullptr, 0);
+    transport.data(high, plane_fill);
+    fill = 2 * plane_fill;
+  } else if (this->native_polarity_ && !this->rotated_ && !this->grayscale_ && write.source != nullptr &&
+      row_bytes == this->row_bytes_) {
+    // A native-polarity buffer needs no transform, and full-width rows are
+    // contiguous, so the frame buffer is handed to the transport as-is
+    size_t rows = std::min<size_t>(window.y_end - this->write_row_ + 1, this->staging_bytes_ / row_bytes);
+    fill = rows * row_bytes;
+    transport.data(write.source + this->write_row_ * row_bytes, fill);
+    this->write_row_ += rows;
+  } else {
+    // Otherwise gather whole window rows into the staging buffer. Rows of a
+    // window aren't contiguous in the frame buffer, and by default the data
+    // is inverted on the way out:
+    // this display: 0xFF = black, 0x00 = white (confirmed by testing)
+    // ESPHome buffer: bits set = foreground (COLOR_ON), cleared = background
+    // With hardware rotation the X counter runs backwards, which mirrors
+    // bytes but not the pixels inside them, so each byte is bit-reversed.
+    const uint8_t invert = this->native_polarity_ ? 0x00 : 0xFF;
+    while (this->write_row_ <= window.y_end && fill + row_bytes <= this->staging_bytes_) {
+      uint8_t *out = this->staging_ + fill;
+      if (write.source == nullptr) {
+        memset(out, 0x00, row_bytes);
+      } else {
+        const uint8_t *row = write.source + this->write_row_ * this->row_bytes_ + window.x_start;
+        pack_plane_row(out, row, row_bytes, invert, this->rotated_);
+      }
+      fill += row_bytes;
+      this->write_row_++;
+    }
+    transport.data(this->staging_, fill);
+  }
+  this->bytes_ += fill;
+  
+  if (this->write_row_ > window.y_end) {
+    this->write_index_++;
+    this->write_started_ = false;
+  }
+  return this->write_index_ >= this->write_count_;
+}
+
+}  // namespace ssd1680_epaper
+}  // namespace esphome
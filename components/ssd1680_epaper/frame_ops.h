@@ -0,0 +1,312 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Frame buffer operations of the SSD1680 driver that don't touch the
+// hardware: pixel drawing, RAM windows, the shadow diff, region splitting and
+// plane packing.
+// Only the standard library is used, so this part also builds on a host
+// (see tests/), with the controller behind the Transport interface.
+
+namespace esphome {
+namespace ssd1680_epaper {
+
+// Supported SSD1680 panels, selected at compile time with the model option
+// (display.py defines SSD1680_EPAPER_MODEL to one of these)
+enum PanelModel : uint8_t {
+  PANEL_MODEL_2_90IN = 0,  // 128x296
+  PANEL_MODEL_2_13IN,      // 122x250
+  PANEL_MODEL_2_66IN,      // 152x296
+};
+
+struct PanelGeometry {
+  uint16_t width;   // source pixels
+  uint16_t height;  // gate lines
+};
+
+static constexpr PanelGeometry PANEL_GEOMETRIES[] = {
+    {128, 296},
+    {122, 250},
+    {152, 296},
+};
+
+// RAM window in controller units: X in bytes (8 pixels), Y in gate lines.
+// Both ranges are inclusive, x_start > x_end marks an empty window.
+struct RamWindow {
+  uint8_t x_start;
+  uint8_t x_end;
+  uint16_t y_start;
+  uint16_t y_end;
+  
+  bool is_empty() const { return this->x_start > this->x_end; }
+};
+
+// Changed bytes of one RAM row, x_start > x_end when the row is unchanged
+struct RowSpan {
+  uint8_t x_start;
+  uint8_t x_end;
+  
+  bool is_empty() const { return this->x_start > this->x_end; }
+};
+
+static const RamWindow EMPTY_WINDOW = {0xFF, 0x00, 0xFFFF, 0x0000};
+
+// Most windows a frame is split into, see split_regions()
+static const uint8_t MAX_FRAME_REGIONS = 3;
+
+// Byte-level link to the controller. The component drives it over SPI and
+// GPIO, the host tests record it.
+class Transport {
+ public:
+  virtual ~Transport() = default;
+  
+  // Command byte and its parameters (DC low, then high), one CS assertion
+  virtual void command(uint8_t cmd, const uint8_t *data, size_t len) = 0;
+  // More parameter bytes for the last command, e.g. a RAM write burst
+  virtual void data(const uint8_t *data, size_t len) = 0;
+  // BUSY level, true while the controller is working
+  virtual bool busy() = 0;
+  // RESET line, true holds the controller in reset
+  virtual void reset(bool hold) = 0;
+  
+  // Shorthands for commands without or with a single parameter byte. A
+  // subclass overriding command() needs `using Transport::command;`.
+  void command(uint8_t cmd) { this->command(cmd, nullptr, 0); }
+  void command(uint8_t cmd, uint8_t data) { this->command(cmd, &data, 1); }
+};
+
+// What RAM 0x26 currently holds
+enum RedRamState : uint8_t {
+  RED_RAM_UNKNOWN = 0,
+  RED_RAM_CLEARED,
+  RED_RAM_PREVIOUS_FRAME,
+};
+
+// What the LUT register currently holds. Any reset goes back to DEFAULT.
+enum LutState : uint8_t {
+  LUT_STATE_DEFAULT = 0,
+  LUT_STATE_OTP,       // loaded from OTP by a full refresh, see waveform_cache
+  LUT_STATE_PARTIAL,   // the partial waveform, uploaded by the partial refresh
+  LUT_STATE_WAVEFORM,  // the configured library waveform
+};
+
+// Controller state that outlives a frame
+struct ControllerState {
+  // Initialized, persistent init may skip the reset sequence
+  bool ready{false};
+  LutState lut{LUT_STATE_DEFAULT};
+  RedRamState red_ram{RED_RAM_UNKNOWN};
+  
+  // Without persistent init every frame resets the controller, with it only
+  // a frame after a fault or a fresh boot
+  bool needs_reset(bool persistent_init) const { return !persistent_init || !this->ready; }
+  
+  // After a reset or a BUSY timeout the controller needs the init sequence
+  // and its waveform again. The RAM planes survive.
+  void invalidate() {
+    this->ready = false;
+    this->lut = LUT_STATE_DEFAULT;
+  }
+};
+
+enum BusyWait : uint8_t {
+  BUSY_WAIT_PENDING = 0,
+  BUSY_WAIT_DONE,
+  BUSY_WAIT_TIMEOUT,
+};
+
+// One BUSY poll of a wait that started elapsed_ms ago. A wait past
+// timeout_ms leaves the controller in an unknown state, so it no longer
+// counts as ready and no cached waveform is trusted: the next frame goes
+// through a reset and loads its LUT again.
+BusyWait poll_busy(Transport &transport, ControllerState &controller, uint32_t elapsed_ms, uint32_t timeout_ms);
+
+// Starts the reset ahead of the init sequence. With hard, RESET is held and
+// the caller releases it after the hold time, otherwise the SW reset in the
+// init sequence does the job.
+void begin_reset(Transport &transport, ControllerState &controller, bool hard);
+
+inline uint32_t window_bytes(const RamWindow &window) {
+  return uint32_t(window.x_end - window.x_start + 1) * (window.y_end - window.y_start + 1);
+}
+
+RamWindow window_union(const RamWindow &a, const RamWindow &b);
+
+// Extra bytes sent when two windows are replaced by their bounding box
+inline uint32_t merge_cost(const RamWindow &a, const RamWindow &b) {
+  return window_bytes(window_union(a, b)) - window_bytes(a) - window_bytes(b);
+}
+
+inline uint8_t reverse_bits(uint8_t b) {
+  b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+  b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+  b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+  return b;
+}
+
+// Ink level 0 (white) to 3 (black) of an RGBW color: the brighter the color,
+// the lighter the pixel. COLOR_ON (all 255) and COLOR_OFF (all 0) keep their
+// binary meaning, black and white, so an opaque white image pixel, which
+// equals COLOR_ON, prints black; see the README.
+inline uint8_t gray_level(uint8_t r, uint8_t g, uint8_t b, uint8_t w) {
+  if ((r & g & b & w) == 0xFF)
+    return 3;
+  if ((r | g | b | w) == 0x00)
+    return 0;
+  return 3 - ((uint16_t(r) * 77 + uint16_t(g) * 150 + uint16_t(b) * 29) >> 14);
+}
+
+// Splits the 8 pixels in hi:lo (2 bpp, MSB first) into their two plane
+// bytes, returned as high plane << 8 | low plane. Both planes are compacted
+// side by side in one 32-bit word, no branch per pixel.
+inline uint16_t gray_planes(uint8_t hi, uint8_t lo) {
+  const uint32_t pixels = uint32_t(hi) << 8 | lo;
+  uint32_t v = (pixels & 0x5555) | ((pixels >> 1) & 0x5555) << 16;
+  v = (v | (v >> 1)) & 0x33333333;
+  v = (v | (v >> 2)) & 0x0F0F0F0F;
+  v = (v | (v >> 4)) & 0x00FF00FF;
+  return (v >> 8 & 0xFF00) | (v & 0xFF);
+}
+
+// Frame buffer pixels in panel coordinates (x along the source lines, y along
+// the gates), 1 bpp MSB first. Callers clip, nothing here checks bounds.
+// Rotations are in degrees, the values of display::DisplayRotation.
+inline void set_pixel(uint8_t *buffer, uint8_t row_bytes, int x, int y, bool set) {
+  uint8_t &cell = buffer[y * row_bytes + x / 8];
+  const uint8_t bit = 0x80 >> (x % 8);
+  cell = set ? (cell | bit) : (cell & ~bit);
+}
+
+// 2 bpp variant, row_bytes is the size of a 2-bpp row
+inline void set_gray_pixel(uint8_t *buffer, uint16_t row_bytes, int x, int y, uint8_t level) {
+  uint8_t &cell = buffer[y * row_bytes + x / 4];
+  const uint8_t shift = 6 - 2 * (x % 4);
+  cell = (cell & ~(0x03 << shift)) | (level << shift);
+}
+
+// Maps the drawing rectangle [x0, x1) x [y0, y1) to inclusive panel
+// coordinates, the same mapping DisplayBuffer::draw_pixel_at() applies per
+// pixel. width and height are the panel's.
+void to_absolute_rect(int rotation, uint16_t width, uint16_t height, int x0, int y0, int x1, int y1, int *ax0,
+                      int *ay0, int *ax1, int *ay1);
+
+// Sets or clears an inclusive panel rectangle. Edge bytes are masked, the
+// bytes in between are written whole.
+void fill_rect_absolute(uint8_t *buffer, uint8_t row_bytes, int x0, int y0, int x1, int y1, bool set);
+
+// Writes 8 horizontally adjacent panel pixels starting at x, which may lie
+// left of the panel as long as the masked bits don't. Bits outside mask are
+// left alone; with transparent, cleared bits are left alone too.
+void write_bits(uint8_t *buffer, uint8_t row_bytes, int x, int y, uint8_t bits, uint8_t mask, bool set,
+                bool transparent);
+
+// Draws a 1-bpp bitmap (rows of (bitmap_width + 7) / 8 bytes, MSB first) with
+// its top left corner at drawing coordinates x/y. The bitmap must lie fully
+// inside the rotated panel. Set bits are drawn as set, cleared ones as !set
+// unless transparent.
+void blit_bitmap(uint8_t *buffer, uint8_t row_bytes, uint16_t width, uint16_t height, int rotation, int x, int y,
+                 int bitmap_width, int bitmap_height, const uint8_t *bitmap, bool set, bool transparent);
+
+// Transpose an 8x8 bit matrix, MSB = leftmost column: out[k] bit (7 - m) =
+// in[m] bit (7 - k)
+void transpose8(const uint8_t *in, uint8_t *out);
+
+// Compares the rows of cur and prev inside dirty (whole rows, X is ignored)
+// 32 bits at a time. Fills rows[y] for every one of the height rows, sets
+// *changed to their bounding box and returns the number of changed bytes.
+// Both buffers must be word aligned and hold a whole number of words.
+uint32_t diff_rows(const uint8_t *cur, const uint8_t *prev, uint8_t row_bytes, uint16_t height,
+                   const RamWindow &dirty, RowSpan *rows, RamWindow *changed);
+
+// Splits the rows of window into at most MAX_FRAME_REGIONS windows that skip
+// unchanged bands of rows. Returns the number of windows written to regions.
+uint8_t split_regions(const RowSpan *rows, const RamWindow &window, RamWindow *regions);
+
+// Sets the controller RAM window and address counters (0x44/0x45/0x4E/0x4F)
+// to window, given in buffer coordinates. Rotated RAM counts down (data
+// entry mode 0x00), so the window then starts at the mirrored far corner.
+void set_ram_window(Transport &transport, const RamWindow &window, uint8_t row_bytes, uint16_t height,
+                    bool rotated);
+
+// One RAM row of a 1-bpp plane: XOR with invert (0xFF turns the ESPHome
+// polarity into the panel's) and, for mirrored RAM, bit-reversed
+void pack_plane_row(uint8_t *out, const uint8_t *row, size_t len, uint8_t invert, bool reversed);
+
+// The low and high plane RAM rows of a 2-bpp row holding 2 * len bytes, in
+// one pass over the row
+void pack_gray_row(uint8_t *low, uint8_t *high, const uint8_t *row, size_t len, bool reversed);
+
+// RAM side of the frame pipeline: queues the plane writes a frame and its
+// partial-refresh reference need, streams them one staging buffer per step()
+// and keeps ControllerState::red_ram up to date
+class FrameWriter {
+ public:
+  // A 1-bpp plane, and the buffer rows are packed into on the way out. In
+  // grayscale staging holds at least two rows, one of each plane.
+  void set_layout(uint8_t row_bytes, uint16_t height, uint8_t *staging, size_t staging_bytes);
+  // Frame buffer format: native polarity skips the inversion, rotated mirrors
+  // the RAM (data entry mode 0x00), grayscale holds 2 bpp
+  void set_format(bool native_polarity, bool rotated, bool grayscale);
+  // keep_reference: partial refresh mode, RED RAM keeps the frame on the
+  // panel. write_once: only clear RED RAM when it isn't cleared already.
+  void set_red_ram(bool keep_reference, bool write_once);
+  
+  // Queues frame: the B/W regions, then RED RAM as needed. A partial frame
+  // whose reference plane was lost gets restore (the frame the panel still
+  // shows) put back first, if there is one.
+  void write_frame(ControllerState &controller, const uint8_t *frame, const RamWindow *regions, uint8_t count,
+                   bool partial, const uint8_t *restore);
+  // Queues the reference for the next partial refresh, once the frame
+  // queued by write_frame() was refreshed
+  void write_reference(ControllerState &controller);
+  // Queues a single plane, source nullptr sends zeros
+  void write_plane(uint8_t command, const RamWindow &window, const uint8_t *source);
+  
+  // Sends the next staging buffer worth of queued data, returns true once
+  // everything queued is sent
+  bool step(Transport &transport);
+  // Plane bytes sent since the last write_*()
+  uint32_t bytes() const { return this->bytes_; }
+  
+ protected:
+  // One queued RAM plane write
+  struct PlaneWrite {
+    uint8_t command;        // 0x24 (B/W) or 0x26 (RED)
+    RamWindow window;
+    const uint8_t *source;  // frame buffer to send, nullptr sends zeros
+  };
+  // The frame regions plus either the RED RAM clear or its restore. In
+  // grayscale a region write sends both planes.
+  static const uint8_t MAX_PLANE_WRITES = MAX_FRAME_REGIONS + 1;
+  
+  void queue_(uint8_t command, const RamWindow &window, const uint8_t *source);
+  void start_();
+  
+  uint8_t row_bytes_{0};
+  uint16_t height_{0};
+  RamWindow full_window_{0xFF, 0x00, 0xFFFF, 0x0000};
+  uint8_t *staging_{nullptr};
+  size_t staging_bytes_{0};
+  bool native_polarity_{false};
+  bool rotated_{false};
+  bool grayscale_{false};
+  bool keep_reference_{false};
+  bool write_once_{false};
+  
+  // The frame in flight, write_reference() sends its regions again
+  const uint8_t *frame_{nullptr};
+  RamWindow regions_[MAX_FRAME_REGIONS];
+  uint8_t region_count_{0};
+  bool partial_{false};
+  
+  PlaneWrite writes_[MAX_PLANE_WRITES];
+  uint8_t write_count_{0};
+  uint8_t write_index_{0};
+  bool write_started_{false};
+  uint16_t write_row_{0};
+  uint32_t bytes_{0};
+};
+
+}  // namespace ssd1680_epaper
+}  // namespace esphome
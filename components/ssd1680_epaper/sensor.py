@@ -0,0 +1,59 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import sensor
+from esphome.const import (
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    ICON_TIMER,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_MILLISECOND,
+)
+from .display import SSD1680EPaper
+
+DEPENDENCIES = ["display"]
+
+CONF_SSD1680_EPAPER_ID = "ssd1680_epaper_id"
+CONF_RENDER_TIME = "render_time"
+CONF_TRANSFER_TIME = "transfer_time"
+CONF_BUSY_WAIT_TIME = "busy_wait_time"
+CONF_REFRESH_TIME = "refresh_time"
+CONF_BUSY_TIMEOUTS = "busy_timeouts"
+CONF_SKIPPED_FRAMES = "skipped_frames"
+
+TIMING_SENSORS = [
+    CONF_RENDER_TIME,
+    CONF_TRANSFER_TIME,
+    CONF_BUSY_WAIT_TIME,
+    CONF_REFRESH_TIME,
+]
+COUNTER_SENSORS = [CONF_BUSY_TIMEOUTS, CONF_SKIPPED_FRAMES]
+
+timing_schema = sensor.sensor_schema(
+    unit_of_measurement=UNIT_MILLISECOND,
+    icon=ICON_TIMER,
+    accuracy_decimals=1,
+    state_class=STATE_CLASS_MEASUREMENT,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
+counter_schema = sensor.sensor_schema(
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
+
+CONFIG_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(CONF_SSD1680_EPAPER_ID): cv.use_id(SSD1680EPaper),
+        **{cv.Optional(key): timing_schema for key in TIMING_SENSORS},
+        **{cv.Optional(key): counter_schema for key in COUNTER_SENSORS},
+    }
+)
+
+
+async def to_code(config):
+    parent = await cg.get_variable(config[CONF_SSD1680_EPAPER_ID])
+
+    for key in TIMING_SENSORS + COUNTER_SENSORS:
+        if key in config:
+            sens = await sensor.new_sensor(config[key])
+            cg.add(getattr(parent, f"set_{key}_sensor")(sens))
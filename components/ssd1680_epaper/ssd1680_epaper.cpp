@@ -1,7 +1,11 @@
 #include "ssd1680_epaper.h"
 #include "esphome/core/log.h"
 #include "esphome/core/application.h"
+#include "esphome/core/helpers.h"
 #include "driver/gpio.h"
+#ifdef SSD1680_EPAPER_RTC_FRAME
+#include "esp_attr.h"
+#endif
 
 namespace esphome {
 namespace ssd1680_epaper {
@@ -9,53 +13,369 @@ namespace ssd1680_epaper {
 static const char *const TAG = "ssd1680_epaper";
 
 // VERSION 2 - Deferred init for debugging
-// Display dimensions for 2.9" display
-static const uint16_t WIDTH = 128;
-static const uint16_t HEIGHT = 296;
-static const uint32_t ALLSCREEN_BYTES = (WIDTH * HEIGHT) / 8;
+// Display dimensions of the panel selected with the model option. Rows are
+// padded to whole RAM bytes when the width isn't a multiple of 8.
+static constexpr uint16_t WIDTH = PANEL.width;
+static constexpr uint16_t HEIGHT = PANEL.height;
+static constexpr uint8_t ROW_BYTES = (WIDTH + 7) / 8;
+static constexpr uint32_t ALLSCREEN_BYTES = uint32_t(ROW_BYTES) * HEIGHT;
+// Grayscale rows: 2 bits per pixel, padded like the 1-bpp rows
+static constexpr uint16_t GRAY_ROW_BYTES = ROW_BYTES * 2;
+static const RamWindow FULL_WINDOW = {0, ROW_BYTES - 1, 0, HEIGHT - 1};
+// diff_rows() compares the frame buffers a word at a time
+static_assert(ALLSCREEN_BYTES % 4 == 0, "frame buffer must hold a whole number of words");
+
+// BUSY timeouts (ms)
+static const uint32_t IDLE_TIMEOUT_MS = 10000;
+static const uint32_t FULL_REFRESH_TIMEOUT_MS = 5000;
+static const uint32_t PARTIAL_REFRESH_TIMEOUT_MS = 2000;
+// Without a BUSY pin, assume the controller needs this long
+static const uint32_t NO_BUSY_IDLE_MS = 100;
+static const uint32_t NO_BUSY_FULL_REFRESH_MS = 3000;
+static const uint32_t NO_BUSY_PARTIAL_REFRESH_MS = 500;
+// Adaptive refresh timeout: when BUSY is unreliable, wait for the learned
+// refresh duration plus 25% plus this margin instead of the fixed ceiling
+static const uint32_t REFRESH_MARGIN_MS = 100;
+// Temperature bands for learned refresh durations (upper limits in C, the
+// last band is open-ended)
+static const float TEMP_BAND_LIMITS[] = {5.0f, 15.0f, 25.0f};
+// With waveform_cache and only the internal sensor, re-read the temperature
+// (and reload the LUT) at most this often
+static const uint32_t INTERNAL_TEMP_RELOAD_MS = 10 * 60 * 1000;
+// Supply settle time after re-powering the panel in low power mode
+static const uint32_t PANEL_POWER_ON_MS = 20;
+// Tag of a valid RTC frame, combined with the buffer layout
+static const uint32_t RTC_FRAME_MAGIC = 0x5D168000UL;
+static const char *const BUFFER_LOCATION_NAMES[] = {"auto", "internal RAM", "PSRAM"};
+// CrowPanel e-paper supply switch (active high)
+static const gpio_num_t PANEL_POWER_PIN = GPIO_NUM_7;
+// RESET pin of the CrowPanel, read back by pin_swap_test_()
+static const gpio_num_t PIN_SWAP_TEST_PIN = GPIO_NUM_47;
+
+#ifdef SSD1680_EPAPER_WORKER_TASK
+static const uint32_t WORKER_STACK_SIZE = 4096;
+static const UBaseType_t WORKER_PRIORITY = 1;
+#endif
+
+// Pixels per iteration of the draw_pixel_at() benchmark
+static const uint32_t BENCHMARK_PIXELS = 10000;
+static const char *const BENCHMARK_TEXT = "The quick brown fox 0123456789";
+
+// Known-good SPI rate used when init fails at a faster configured rate
+static const uint32_t FALLBACK_DATA_RATE = spi::DATA_RATE_4MHZ;
+// Size of the internal-RAM (DMA-capable) staging buffer. RAM planes are
+// streamed one staging buffer per loop() pass.
+static const size_t STAGING_BYTES = 1024;
+
+// Partial refresh waveform (register 0x32, 153 bytes)
+// VS L0-L4, then TP/SR/RP for groups 0-11, then FR
+static const uint8_t LUT_PARTIAL[153] = {
+    0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // L0 (B->B)
+    0x80, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // L1 (B->W)
+    0x40, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // L2 (W->B)
+    0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // L3 (W->W)
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // L4 (VCOM)
+    0x0A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 0
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 1
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 2
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 3
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 4
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 5
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 6
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 7
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 8
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 9
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 10
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 11
+    0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x00, 0x00, 0x00,                    // FR
+};
+
+// Waveform library for full refreshes (waveform option). Based on the
+// Waveshare 2.9" V2 (SSD1680) waveforms, same layout as LUT_PARTIAL.
+// WS_20_30 full refresh
+static const uint8_t LUT_FULL[153] = {
+    0x80, 0x66, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00,  // L0
+    0x10, 0x66, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,  // L1
+    0x80, 0x66, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00,  // L2
+    0x10, 0x66, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,  // L3
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // L4 (VCOM)
+    0x14, 0x08, 0x00, 0x00, 0x00, 0x00, 0x01,                                // Group 0
+    0x0A, 0x0A, 0x00, 0x0A, 0x0A, 0x00, 0x01,                                // Group 1
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 2
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 3
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 4
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 5
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 6
+    0x14, 0x08, 0x00, 0x01, 0x00, 0x00, 0x01,                                // Group 7
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,                                // Group 8
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 9
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 10
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 11
+    0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x00, 0x00, 0x00,                    // FR
+};
+
+// 4 gray levels, selected per pixel by the RED (0x26) and B/W (0x24) bits
+static const uint8_t LUT_GRAY4[153] = {
+    0x00, 0x60, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // L0
+    0x20, 0x60, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // L1
+    0x28, 0x60, 0x14, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // L2
+    0x2A, 0x60, 0x15, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // L3
+    0x00, 0x90, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // L4 (VCOM)
+    0x00, 0x02, 0x00, 0x05, 0x14, 0x00, 0x00,                                // Group 0
+    0x1E, 0x1E, 0x00, 0x00, 0x00, 0x00, 0x01,                                // Group 1
+    0x00, 0x02, 0x00, 0x05, 0x14, 0x00, 0x00,                                // Group 2
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 3
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 4
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 5
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 6
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 7
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 8
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 9
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 10
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,                                // Group 11
+    0x24, 0x22, 0x22, 0x22, 0x23, 0x32, 0x00, 0x00, 0x00,                    // FR
+};
+
+// A waveform with the voltages it was tuned for: EOPT (0x3F), VGH (0x03),
+// VSH1/VSH2/VSL (0x04) and VCOM (0x2C)
+struct WaveformTable {
+  const uint8_t *lut;
+  uint8_t voltages[6];
+};
+
+static const char *const WAVEFORM_NAMES[] = {"otp", "full", "gray4"};
+
+// Indexed by Waveform, WAVEFORM_OTP has no table
+static const WaveformTable WAVEFORMS[] = {
+    {nullptr, {}},
+    {LUT_FULL, {0x22, 0x17, 0x41, 0x00, 0x32, 0x36}},
+    {LUT_GRAY4, {0x22, 0x17, 0x41, 0xAE, 0x32, 0x28}},
+};
+static const WaveformTable WAVEFORM_PARTIAL = {LUT_PARTIAL, {0x22, 0x17, 0x41, 0xB0, 0x32, 0x36}};
+
+// Allocates from the requested memory and falls back to the other kind when
+// it is missing or full. *location is set to where the buffer ended up.
+static uint8_t *allocate_buffer(BufferLocation *location, size_t size, const char *name) {
+  using Allocator = RAMAllocator<uint8_t>;
+  bool internal = *location == BUFFER_LOCATION_INTERNAL;
+  Allocator preferred(internal ? Allocator::ALLOC_INTERNAL : Allocator::ALLOC_EXTERNAL);
+  uint8_t *buffer = preferred.allocate(size);
+  if (buffer != nullptr) {
+    *location = internal ? BUFFER_LOCATION_INTERNAL : BUFFER_LOCATION_PSRAM;
+    return buffer;
+  }
+  
+  if (*location != BUFFER_LOCATION_AUTO) {
+    ESP_LOGW(TAG, "Could not allocate the %s in %s, using %s", name, internal ? "internal RAM" : "PSRAM",
+             internal ? "PSRAM" : "internal RAM");
+  }
+  Allocator fallback(internal ? Allocator::ALLOC_EXTERNAL : Allocator::ALLOC_INTERNAL);
+  *location = internal ? BUFFER_LOCATION_PSRAM : BUFFER_LOCATION_INTERNAL;
+  return fallback.allocate(size);
+}
+
+// Init sequence shared by init_display_() and the frame pipeline. Each entry
+// is the command, a length byte and that many parameters. SEQ_WAIT in the
+// length byte means a delay (ms) follows; after it the controller is given at
+// least that long and then must drop BUSY before the next entry.
+static const uint8_t SEQ_WAIT = 0x80;
+static const uint8_t SEQ_LEN_MASK = 0x7F;
+static const uint8_t INIT_SEQUENCE[] = {
+    0x12, SEQ_WAIT | 0, 10,                             // SW reset
+    0x01, 3, (HEIGHT - 1) & 0xFF, (HEIGHT - 1) >> 8, 0x00,  // driver output: gate lines - 1, GD=0, SM=0, TB=0
+    0x3C, 1, 0x05,                                      // border waveform
+    0x18, 1, 0x80,                                      // internal temperature sensor
+};
+
+#ifdef SSD1680_EPAPER_RTC_FRAME
+// Last frame sent to the panel, kept in RTC memory across deep sleep so the
+// first frame after a wake can still be a partial update against it. Only
+// compiled in with low_power, it takes a frame worth of RTC RAM.
+static RTC_DATA_ATTR uint8_t rtc_frame[ALLSCREEN_BYTES];
+static RTC_DATA_ATTR uint32_t rtc_frame_tag;
+static RTC_DATA_ATTR uint32_t rtc_at_update;
+#endif
 
 void SSD1680EPaper::setup() {
-  ESP_LOGI(TAG, "=== SSD1680 SETUP V4 - WITH POWER PIN ===");
+  if (this->diagnostics_) {
+    ESP_LOGI(TAG, "=== SSD1680 SETUP V4 - WITH POWER PIN ===");
+  }
   
   // CRITICAL: Enable display power on GPIO7
-  // The CrowPanel requires GPIO7 HIGH to power the e-paper display
+  // The CrowPanel requires GPIO7 HIGH to power the e-paper display. It may
+  // still be held LOW from before deep sleep.
+  gpio_hold_dis(PANEL_POWER_PIN);
   gpio_config_t pwr_conf = {};
-  pwr_conf.pin_bit_mask = (1ULL << 7);
+  pwr_conf.pin_bit_mask = (1ULL << PANEL_POWER_PIN);
   pwr_conf.mode = GPIO_MODE_OUTPUT;
   pwr_conf.pull_up_en = GPIO_PULLUP_DISABLE;
   pwr_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
   gpio_config(&pwr_conf);
-  gpio_set_level(GPIO_NUM_7, 1);
-  ESP_LOGI(TAG, "GPIO7 (display power) set HIGH");
-  delay(100);  // Give power time to stabilize
+  this->panel_power_(true);
+  ESP_LOGD(TAG, "GPIO7 (display power) set HIGH");
+  // Give power time to stabilize. In low power mode the first frame holds
+  // the panel in reset while it settles instead of blocking setup, so the
+  // supply counts as not yet up.
+  if (this->low_power_) {
+    this->panel_powered_ = false;
+  } else {
+    delay(100);
+  }
   
   this->dc_pin_->setup();
   this->dc_pin_->digital_write(false);
   
   if (this->reset_pin_ != nullptr) {
     this->reset_pin_->setup();
-    this->reset_pin_->digital_write(true);
+    this->reset(false);
   }
   
   if (this->busy_pin_ != nullptr) {
     this->busy_pin_->setup();
+    if (this->busy_interrupt_) {
+      if (this->busy_pin_->is_internal()) {
+        static_cast<InternalGPIOPin *>(this->busy_pin_)
+            ->attach_interrupt(SSD1680EPaper::busy_isr_, this, gpio::INTERRUPT_FALLING_EDGE);
+      } else {
+        ESP_LOGW(TAG, "BUSY interrupt needs an internal GPIO, falling back to polling");
+        this->busy_interrupt_ = false;
+      }
+    }
   }
   
   this->spi_setup();
   
-  // Initialize the display buffer
-  this->init_internal_(ALLSCREEN_BYTES);
-  memset(this->buffer_, 0xFF, ALLSCREEN_BYTES);
+#ifdef USE_SENSOR
+  if (this->temperature_sensor_ != nullptr) {
+    this->temperature_sensor_->add_on_state_callback([this](float state) { this->set_temperature(state); });
+    if (this->temperature_sensor_->has_state())
+      this->set_temperature(this->temperature_sensor_->state);
+  }
+#endif
+  
+  // The controller can flip the RAM address counters, but a RAM byte is
+  // always 8 pixels along the source lines, so only 180 degrees can be done
+  // without reshuffling bits across bytes. Drawing then happens unrotated.
+  if (this->hardware_rotation_) {
+    if (WIDTH % 8 != 0) {
+      // Mirrored RAM would move the row padding to the visible side
+      ESP_LOGW(TAG, "Hardware rotation needs a panel width that is a multiple of 8, rotating in software");
+    } else if (this->rotation_ == display::DISPLAY_ROTATION_180_DEGREES) {
+      this->ram_rotated_ = true;
+      this->rotation_ = display::DISPLAY_ROTATION_0_DEGREES;
+    } else if (this->rotation_ != display::DISPLAY_ROTATION_0_DEGREES) {
+      ESP_LOGW(TAG, "Hardware rotation only supports 180 degrees, rotating in software");
+    }
+  }
+  
+  // Staging buffer for the RAM transfer, kept in internal RAM so the SPI
+  // driver can DMA straight out of it
+  RAMAllocator<uint8_t> internal_allocator(RAMAllocator<uint8_t>::ALLOC_INTERNAL);
+  this->staging_ = internal_allocator.allocate(STAGING_BYTES);
+  if (this->staging_ == nullptr) {
+    ESP_LOGE(TAG, "Could not allocate SPI staging buffer");
+    this->mark_failed();
+    return;
+  }
+  this->writer_.set_layout(ROW_BYTES, HEIGHT, this->staging_, STAGING_BYTES);
+  this->writer_.set_format(this->native_polarity_, this->ram_rotated_, this->grayscale_);
+  
+  // Initialize the display buffer. Drawing touches it byte by byte, so under
+  // cache pressure internal RAM can be noticeably faster than PSRAM.
+  this->buffer_ = allocate_buffer(&this->buffer_location_, this->buffer_bytes_(), "frame buffer");
+  if (this->buffer_ == nullptr) {
+    ESP_LOGE(TAG, "Could not allocate frame buffer");
+    this->mark_failed();
+    return;
+  }
+  // All pixels on, in whichever polarity the buffer is kept in
+  memset(this->buffer_, this->native_polarity_ ? 0x00 : 0xFF, this->buffer_bytes_());
+  this->frame_buffer_ = this->buffer_;
+  
+#ifdef SSD1680_EPAPER_WORKER_TASK
+  if (this->worker_task_) {
+    BufferLocation location = this->buffer_location_;
+    uint8_t *frame = allocate_buffer(&location, this->buffer_bytes_(), "transfer frame buffer");
+    // Pin the worker to the core the main loop isn't running on
+#if CONFIG_FREERTOS_UNICORE
+    const BaseType_t core = 0;
+#else
+    const BaseType_t core = xPortGetCoreID() == 0 ? 1 : 0;
+#endif
+    if (frame != nullptr && xTaskCreatePinnedToCore(SSD1680EPaper::worker_loop_, "ssd1680_epaper", WORKER_STACK_SIZE,
+                                                    this, WORKER_PRIORITY, &this->worker_handle_, core) == pdPASS) {
+      this->frame_buffer_ = frame;
+      ESP_LOGD(TAG, "Frame pipeline runs in a worker task on core %d", (int) core);
+    } else {
+      ESP_LOGW(TAG, "Could not start the worker task, running the frame pipeline from loop()");
+      this->worker_handle_ = nullptr;
+    }
+  }
+#endif
+  
+  if (this->dirty_tracking_) {
+    this->previous_buffer_ = allocate_buffer(&this->shadow_buffer_location_, ALLSCREEN_BYTES, "previous frame buffer");
+    RAMAllocator<RowSpan> span_allocator(RAMAllocator<RowSpan>::ALLOC_INTERNAL);
+    this->diff_rows_ = span_allocator.allocate(HEIGHT);
+    if (this->previous_buffer_ == nullptr || this->diff_rows_ == nullptr) {
+      ESP_LOGE(TAG, "Could not allocate previous frame buffer, dirty tracking disabled");
+      this->dirty_tracking_ = false;
+    }
+  }
+  
+#ifdef SSD1680_EPAPER_RTC_FRAME
+  // A frame from before deep sleep (same layout) is what the panel shows
+  if (this->rtc_frame_valid_()) {
+    this->at_update_ = rtc_at_update % this->full_update_every_;
+    ESP_LOGD(TAG, "Previous frame restored from RTC memory");
+  }
+#endif
   
   this->initialized_ = false;
-  ESP_LOGI(TAG, "Setup complete, display init deferred");
+  ESP_LOGD(TAG, "Setup complete, display init deferred");
 }
 
 void SSD1680EPaper::dump_config() {
   LOG_DISPLAY("", "SSD1680 E-Paper", this);
+  ESP_LOGCONFIG(TAG, "  Panel: %ux%u", WIDTH, HEIGHT);
+  ESP_LOGCONFIG(TAG, "  Frame buffer: %s", BUFFER_LOCATION_NAMES[this->buffer_location_]);
+  if (this->dirty_tracking_) {
+    ESP_LOGCONFIG(TAG, "  Previous frame buffer: %s", BUFFER_LOCATION_NAMES[this->shadow_buffer_location_]);
+  }
+  ESP_LOGCONFIG(TAG, "  SPI data rate: %u kHz", (unsigned) (this->data_rate_ / 1000));
   LOG_PIN("  DC Pin: ", this->dc_pin_);
   LOG_PIN("  Reset Pin: ", this->reset_pin_);
   LOG_PIN("  Busy Pin: ", this->busy_pin_);
+  if (this->busy_pin_ != nullptr) {
+    ESP_LOGCONFIG(TAG, "  BUSY interrupt: %s", YESNO(this->busy_interrupt_));
+  }
+  ESP_LOGCONFIG(TAG, "  RED RAM write once: %s", YESNO(this->red_ram_write_once_));
+  if (this->refresh_mode_ == REFRESH_MODE_PARTIAL) {
+    ESP_LOGCONFIG(TAG, "  Refresh mode: partial, full update every %u", (unsigned) this->full_update_every_);
+  } else {
+    ESP_LOGCONFIG(TAG, "  Refresh mode: full");
+  }
+  if (this->min_refresh_interval_ > 0) {
+    ESP_LOGCONFIG(TAG, "  Minimum refresh interval: %u ms", (unsigned) this->min_refresh_interval_);
+  }
+  ESP_LOGCONFIG(TAG, "  Dirty tracking: %s", YESNO(this->dirty_tracking_));
+  ESP_LOGCONFIG(TAG, "  Skip unchanged frames: %s", YESNO(this->skip_unchanged_));
+  ESP_LOGCONFIG(TAG, "  Persistent init: %s", YESNO(this->persistent_init_));
+  ESP_LOGCONFIG(TAG, "  Native polarity buffer: %s", YESNO(this->native_polarity_));
+  ESP_LOGCONFIG(TAG, "  Hardware rotation (180 degrees): %s", YESNO(this->ram_rotated_));
+  ESP_LOGCONFIG(TAG, "  Adaptive refresh timeout: %s", YESNO(this->adaptive_timeout_));
+  ESP_LOGCONFIG(TAG, "  Waveform: %s", WAVEFORM_NAMES[this->waveform_]);
+  ESP_LOGCONFIG(TAG, "  Worker task: %s", YESNO(this->worker_running_()));
+  ESP_LOGCONFIG(TAG, "  Grayscale (4 levels): %s", YESNO(this->grayscale_));
+  ESP_LOGCONFIG(TAG, "  Waveform cache: %s", YESNO(this->waveform_cache_));
+#ifdef USE_SENSOR
+  LOG_SENSOR("  ", "Temperature", this->temperature_sensor_);
+#endif
+  ESP_LOGCONFIG(TAG, "  Diagnostics: %s", YESNO(this->diagnostics_));
+  ESP_LOGCONFIG(TAG, "  Low power: %s", YESNO(this->low_power_));
+  if (this->low_power_) {
+    ESP_LOGCONFIG(TAG, "  Cut panel power after refresh: %s", YESNO(this->cut_panel_power_));
+  }
   if (this->busy_pin_ != nullptr) {
     ESP_LOGCONFIG(TAG, "  Current BUSY state: %s", this->busy_pin_->digital_read() ? "HIGH (busy)" : "LOW (idle)");
   }
@@ -67,61 +387,177 @@ void SSD1680EPaper::hw_reset_() {
     ESP_LOGW(TAG, "No reset pin configured!");
     return;
   }
-    
-  ESP_LOGD(TAG, "Hardware reset...");
-  this->reset_pin_->digital_write(true);
+  
+  // The SW reset that follows polls BUSY, so no settle delay is needed here
+  this->reset(false);
   delay(10);
-  this->reset_pin_->digital_write(false);
+  this->reset(true);
   delay(10);
-  this->reset_pin_->digital_write(true);
+  this->reset(false);
   delay(10);
 }
 
-void SSD1680EPaper::wait_until_idle_() {
-  if (this->busy_pin_ == nullptr) {
-    ESP_LOGD(TAG, "No busy pin, using fixed delay");
-    delay(100);
-    return;
-  }
-    
-  uint32_t start = millis();
-  bool initial = this->busy_pin_->digital_read();
-  ESP_LOGD(TAG, "Waiting for idle, initial busy pin state: %d (HIGH=busy)", initial);
+void SSD1680EPaper::wait_idle_then_(FrameState next, uint32_t min_delay_ms) {
+  // Without a BUSY pin there is nothing to poll, just wait a fixed time
+  if (this->busy_pin_ == nullptr && min_delay_ms < NO_BUSY_IDLE_MS)
+    min_delay_ms = NO_BUSY_IDLE_MS;
   
-  while (this->busy_pin_->digital_read()) {
-    if (millis() - start > 10000) {
-      ESP_LOGE(TAG, "Timeout waiting for display (busy pin stuck HIGH)");
-      return;
+  this->wait_start_ = millis();
+  this->wait_min_ms_ = min_delay_ms;
+  this->next_state_ = next;
+  this->state_ = FRAME_STATE_WAIT_IDLE;
+}
+
+bool SSD1680EPaper::wait_idle_done_() {
+  uint32_t elapsed = millis() - this->wait_start_;
+  if (elapsed < this->wait_min_ms_)
+    return false;
+  
+  if (this->busy_pin_ != nullptr) {
+    switch (poll_busy(*this, this->controller_, elapsed, IDLE_TIMEOUT_MS)) {
+      case BUSY_WAIT_PENDING:
+        return false;
+      case BUSY_WAIT_TIMEOUT:
+        // Continue anyway, the next step will usually recover the controller
+        ESP_LOGE(TAG, "Timeout waiting for display (busy pin stuck HIGH)");
+        this->busy_timeouts_++;
+        this->busy_wait_ms_ += elapsed;
+        return true;
+      case BUSY_WAIT_DONE:
+        ESP_LOGV(TAG, "Display idle after %lu ms", elapsed);
+        break;
     }
-    delay(10);
-    App.feed_wdt();
   }
-  ESP_LOGD(TAG, "Display idle after %lu ms", millis() - start);
-  delay(10);
+  this->busy_wait_ms_ += elapsed;
+  return true;
+}
+
+void IRAM_ATTR SSD1680EPaper::busy_isr_(SSD1680EPaper *arg) {
+  arg->busy_release_ms_ = millis();
+  arg->busy_released_ = true;
 }
 
-void SSD1680EPaper::command_(uint8_t cmd) {
+void SSD1680EPaper::arm_busy_() {
+  // Called right before a command that raises BUSY, so the next falling edge
+  // belongs to that command
+  this->busy_released_ = false;
+}
+
+bool SSD1680EPaper::busy() {
+  // A falling edge since the last command means the controller finished, no
+  // need to touch the GPIO. BUSY may also never have gone HIGH, so fall back
+  // to reading the pin.
+  if (this->busy_pin_ == nullptr || this->busy_released_)
+    return false;
+  return this->busy_pin_->digital_read();
+}
+
+void SSD1680EPaper::reset(bool hold) {
+  if (this->reset_pin_ != nullptr)
+    this->reset_pin_->digital_write(!hold);
+}
+
+void SSD1680EPaper::command(uint8_t cmd, const uint8_t *data, size_t len) {
+  // Command and parameters go out in one CS assertion, only DC flips between
+  // them (the controller samples DC on the last bit of each byte)
   this->dc_pin_->digital_write(false);
   this->enable();
   this->write_byte(cmd);
+  if (len > 0) {
+    this->dc_pin_->digital_write(true);
+    this->write_array(data, len);
+  }
   this->disable();
 }
 
-void SSD1680EPaper::data_(uint8_t data) {
-  this->dc_pin_->digital_write(true);
-  this->enable();
-  this->write_byte(data);
-  this->disable();
+bool SSD1680EPaper::play_sequence_(const uint8_t *seq, size_t len, size_t *pos, uint32_t *delay_ms) {
+  // Send entries until one with SEQ_WAIT, returns true with its delay so the
+  // caller can wait (blocking or via the state machine) and resume at *pos.
+  // Returns false once the sequence is done.
+  while (*pos < len) {
+    uint8_t cmd = seq[(*pos)++];
+    uint8_t flags = seq[(*pos)++];
+    uint8_t count = flags & SEQ_LEN_MASK;
+    bool wait = flags & SEQ_WAIT;
+    if (wait)
+      this->arm_busy_();
+    this->command(cmd, seq + *pos, count);
+    *pos += count;
+    if (wait) {
+      *delay_ms = seq[(*pos)++];
+      return true;
+    }
+  }
+  return false;
 }
 
-void SSD1680EPaper::send_data_(const uint8_t *data, size_t len) {
+void SSD1680EPaper::data(const uint8_t *data, size_t len) {
   this->dc_pin_->digital_write(true);
   this->enable();
   this->write_array(data, len);
   this->disable();
 }
 
+bool SSD1680EPaper::transfer_step_() {
+  uint32_t start = micros();
+  bool done = this->writer_.step(*this);
+  this->transfer_us_ += micros() - start;
+  return done;
+}
+
 void SSD1680EPaper::init_display_() {
+  uint32_t init_start = millis();
+  if (this->diagnostics_) {
+    this->verbose_reset_();
+  } else if (this->reset_pin_ != nullptr) {
+    this->hw_reset_();
+  }
+  
+  // SW reset and panel setup from the shared init table. Short timeout for
+  // debugging, a stuck BUSY usually means the bus is garbled.
+  ESP_LOGD(TAG, "Sending init sequence (%u bytes)", (unsigned) sizeof(INIT_SEQUENCE));
+  size_t pos = 0;
+  uint32_t delay_ms = 0;
+  bool sw_reset_ok = true;
+  while (this->play_sequence_(INIT_SEQUENCE, sizeof(INIT_SEQUENCE), &pos, &delay_ms)) {
+    delay(delay_ms);
+    uint32_t start = millis();
+    while (this->busy_pin_ != nullptr && this->busy()) {
+      if (millis() - start > 2000) {
+        ESP_LOGE(TAG, "Init sequence timeout after 2s - continuing anyway");
+        sw_reset_ok = false;
+        break;
+      }
+      delay(10);
+      App.feed_wdt();
+    }
+  }
+  
+  // Data entry mode and RAM window depend on the runtime configuration
+  this->configure_();
+  this->set_ram_window_(FULL_WINDOW);
+  
+  if (this->diagnostics_ && this->busy_pin_ != nullptr) {
+    ESP_LOGI(TAG, "BUSY after all init commands: %d", this->busy_pin_->digital_read());
+  }
+  
+  // RAM content is undefined after power-up
+  this->controller_.red_ram = RED_RAM_UNKNOWN;
+  this->bw_ram_valid_ = false;
+  this->last_frame_valid_ = false;
+  
+  // This is the same sequence the frame pipeline sends, so the first frame
+  // can skip the reset sequence in persistent init mode
+  this->controller_.ready = sw_reset_ok;
+  this->controller_.lut = LUT_STATE_DEFAULT;
+  this->at_update_ = 0;
+  
+  ESP_LOGD(TAG, "Display initialized in %lu ms", millis() - init_start);
+}
+
+// Hardware reset with every step and the BUSY level logged, for bringing up
+// new boards. Only used with the diagnostics option.
+void SSD1680EPaper::verbose_reset_() {
   ESP_LOGI(TAG, ">>> INIT DISPLAY START <<<");
   
   // Log both pins before we do anything
@@ -136,7 +572,7 @@ void SSD1680EPaper::init_display_() {
   // Hardware reset - log each step
   if (this->reset_pin_ != nullptr) {
     ESP_LOGI(TAG, "Setting RESET HIGH...");
-    this->reset_pin_->digital_write(true);
+    this->reset(false);
     delay(10);
     
     if (this->busy_pin_ != nullptr) {
@@ -144,7 +580,7 @@ void SSD1680EPaper::init_display_() {
     }
     
     ESP_LOGI(TAG, "Setting RESET LOW (active reset)...");
-    this->reset_pin_->digital_write(false);
+    this->reset(true);
     delay(10);
     
     if (this->busy_pin_ != nullptr) {
@@ -152,7 +588,7 @@ void SSD1680EPaper::init_display_() {
     }
     
     ESP_LOGI(TAG, "Setting RESET HIGH (release)...");
-    this->reset_pin_->digital_write(true);
+    this->reset(false);
     delay(10);
     
     if (this->busy_pin_ != nullptr) {
@@ -166,240 +602,896 @@ void SSD1680EPaper::init_display_() {
   if (this->busy_pin_ != nullptr) {
     ESP_LOGI(TAG, "BUSY after 100ms post-reset delay: %d", this->busy_pin_->digital_read());
   }
-  
-  // Software reset
-  ESP_LOGD(TAG, "Sending SW reset (0x12)");
-  this->command_(0x12);
-  delay(20);
-  
-  if (this->busy_pin_ != nullptr) {
-    ESP_LOGI(TAG, "BUSY after SW reset: %d", this->busy_pin_->digital_read());
+}
+
+void SSD1680EPaper::full_update_() {
+  // 0xF7 = Enable clock, Load temperature, Load LUT, Display, Disable Analog, Disable OSC
+  // This is the full sequence that actually refreshes the e-paper panel
+  // Without the per-frame SW reset the border stays at the partial setting,
+  // put it back to what init_display_() uses
+  if (this->persistent_init_ && this->controller_.lut == LUT_STATE_PARTIAL) {
+    this->command(0x3C, 0x05);
   }
   
-  // Wait for SW reset - short timeout for debugging
-  uint32_t start = millis();
-  while (this->busy_pin_ != nullptr && this->busy_pin_->digital_read()) {
-    if (millis() - start > 2000) {
-      ESP_LOGE(TAG, "SW Reset timeout after 2s - continuing anyway");
-      break;
+  uint8_t sequence = 0xF7;
+  if (this->waveform_ != WAVEFORM_OTP) {
+    // Library waveform: upload it once, then 0xC7 = Display without loading
+    // temperature or LUT
+    if (this->controller_.lut != LUT_STATE_WAVEFORM) {
+      this->load_waveform_(WAVEFORMS[this->waveform_]);
+      this->controller_.lut = LUT_STATE_WAVEFORM;
     }
-    delay(10);
-    App.feed_wdt();
+    sequence = 0xC7;
+  } else if (this->waveform_cache_) {
+    sequence = this->full_update_sequence_();
+  } else {
+    this->controller_.lut = LUT_STATE_DEFAULT;
+  }
+  ESP_LOGD(TAG, "Full refresh with 0x%02X", sequence);
+  this->command(0x22, sequence);
+  this->arm_busy_();
+  this->command(0x20);
+}
+
+uint8_t SSD1680EPaper::full_update_sequence_() {
+  // The waveform loaded by the last full refresh stays in the LUT register
+  // until a reset or a partial LUT upload. Reuse it with 0xC7 (Display
+  // without loading temperature or LUT) while the temperature band holds.
+  const bool external = !std::isnan(this->temperature_);
+  const uint8_t band = this->temperature_band_();
+  if (this->controller_.lut == LUT_STATE_OTP) {
+    bool same = external ? band == this->lut_band_ : millis() - this->lut_loaded_ms_ < INTERNAL_TEMP_RELOAD_MS;
+    if (same)
+      return 0xC7;
   }
   
-  // Driver output control
-  ESP_LOGD(TAG, "Setting driver output (0x01)");
-  this->command_(0x01);
-  this->data_(0x27);
-  this->data_(0x01);
-  this->data_(0x00);
-  
-  // Data entry mode
-  ESP_LOGD(TAG, "Setting data entry mode (0x11)");
-  this->command_(0x11);
-  this->data_(0x03);
-  
-  // RAM X address
-  ESP_LOGD(TAG, "Setting RAM X (0x44)");
-  this->command_(0x44);
-  this->data_(0x00);
-  this->data_(0x0F);
-  
-  // RAM Y address  
-  ESP_LOGD(TAG, "Setting RAM Y (0x45)");
-  this->command_(0x45);
-  this->data_(0x00);
-  this->data_(0x00);
-  this->data_(0x27);
-  this->data_(0x01);
-  
-  // Border waveform
-  ESP_LOGD(TAG, "Setting border (0x3C)");
-  this->command_(0x3C);
-  this->data_(0x05);
-  
-  // Temperature sensor
-  ESP_LOGD(TAG, "Setting temp sensor (0x18)");
-  this->command_(0x18);
-  this->data_(0x80);
-  
-  // RAM counters
-  this->command_(0x4E);
-  this->data_(0x00);
-  this->command_(0x4F);
-  this->data_(0x00);
-  this->data_(0x00);
-  
-  if (this->busy_pin_ != nullptr) {
-    ESP_LOGI(TAG, "BUSY after all init commands: %d", this->busy_pin_->digital_read());
+  this->controller_.lut = LUT_STATE_OTP;
+  this->lut_band_ = band;
+  this->lut_loaded_ms_ = millis();
+  if (!external) {
+    // Read the internal sensor now and cache the waveform it selects
+    return 0xF7;
   }
   
-  ESP_LOGI(TAG, ">>> INIT DISPLAY COMPLETE <<<");
+  // Known temperature: write it to the temperature register (12 bit, 1/16 C)
+  // and load the LUT for it without reading the internal sensor (0xD7)
+  int16_t value = lroundf(this->temperature_ * 16.0f);
+  const uint8_t temperature[] = {uint8_t((value >> 4) & 0xFF), uint8_t((value & 0x0F) << 4)};
+  this->command(0x1A, temperature, sizeof(temperature));
+  return 0xD7;
 }
 
-void SSD1680EPaper::full_update_() {
-  ESP_LOGD(TAG, "Full refresh with 0xF7");
+void SSD1680EPaper::load_waveform_(const WaveformTable &waveform) {
+  this->command(0x32, waveform.lut, 153);
+  this->command(0x3F, waveform.voltages[0]);      // EOPT
+  this->command(0x03, waveform.voltages[1]);      // gate voltage
+  this->command(0x04, &waveform.voltages[2], 3);  // source voltages
+  this->command(0x2C, waveform.voltages[5]);      // VCOM
+}
+
+void SSD1680EPaper::partial_update_() {
+  ESP_LOGD(TAG, "Partial refresh with 0xCF");
   
-  // 0xF7 = Enable clock, Load temperature, Load LUT, Display, Disable Analog, Disable OSC
-  // This is the full sequence that actually refreshes the e-paper panel
-  this->command_(0x22);
-  this->data_(0xF7);
-  this->command_(0x20);
+  // A SW reset or a full refresh (which loads the OTP LUT) replaces the LUT
+  // register, so upload the partial waveform again after either
+  // With a library waveform the voltages were changed too, so restore the
+  // ones the partial waveform was tuned for
+  if (this->controller_.lut != LUT_STATE_PARTIAL) {
+    if (this->waveform_ != WAVEFORM_OTP) {
+      this->load_waveform_(WAVEFORM_PARTIAL);
+    } else {
+      this->command(0x32, LUT_PARTIAL, sizeof(LUT_PARTIAL));
+    }
+    this->controller_.lut = LUT_STATE_PARTIAL;
+  }
+  
+  // Border follows VCOM (floating) so it doesn't flash on partial updates
+  this->command(0x3C, 0x80);
   
-  // Wait for refresh to complete
+  // 0xCF = Enable clock, Enable analog, Display with mode 2 (differential
+  // against RAM 0x26), Disable Analog, Disable OSC. No temperature/LUT load,
+  // the LUT uploaded above is used as-is
+  this->command(0x22, 0xCF);
+  this->arm_busy_();
+  this->command(0x20);
+}
+
+bool SSD1680EPaper::refresh_done_() {
   // Note: BUSY pin may not go LOW on this display, but refresh still works
-  // Typical full refresh takes 2-4 seconds
-  uint32_t start = millis();
-  while (this->busy_pin_ != nullptr && this->busy_pin_->digital_read()) {
-    if (millis() - start > 5000) {  // 5 second timeout
-      // This is normal - BUSY doesn't always go LOW on this display
-      ESP_LOGD(TAG, "Update timeout (normal for this display) - took %lu ms", millis() - start);
-      break;
-    }
-    delay(100);
-    App.feed_wdt();
+  // Typical full refresh takes 2-4 seconds, partial refresh 300-500 ms
+  uint32_t elapsed = millis() - this->refresh_start_;
+  if (this->busy_pin_ == nullptr) {
+    if (elapsed < (this->frame_partial_ ? NO_BUSY_PARTIAL_REFRESH_MS : NO_BUSY_FULL_REFRESH_MS))
+      return false;
+    this->refresh_ms_ = elapsed;
+    this->frame_refreshed_ = true;
+    return true;
   }
   
-  if (millis() - start < 5000) {
-    ESP_LOGD(TAG, "Update completed in %lu ms", millis() - start);
+  const uint8_t mode = this->frame_partial_ ? 1 : 0;
+  uint32_t timeout = this->refresh_timeout_();
+  const BusyWait wait = poll_busy(*this, this->controller_, elapsed, timeout);
+  if (wait == BUSY_WAIT_PENDING)
+    return false;
+  if (wait == BUSY_WAIT_TIMEOUT) {
+    // This is normal - BUSY doesn't always go LOW on this display. In
+    // persistent init mode it still forces a full reset on the next frame.
+    ESP_LOGD(TAG, "Update timeout (normal for this display) - took %lu ms", elapsed);
+    this->busy_unreliable_[mode] = true;
+    this->busy_timeouts_++;
+    this->refresh_ms_ = elapsed;
+    this->frame_refreshed_ = false;
+    return true;
   }
+  
+  // The ISR timestamp is exact, loop() only notices the edge on its next pass
+  if (this->busy_released_)
+    elapsed = this->busy_release_ms_ - this->refresh_start_;
+  ESP_LOGD(TAG, "Update completed in %lu ms", elapsed);
+  this->refresh_ms_ = elapsed;
+  this->busy_unreliable_[mode] = false;
+  this->frame_refreshed_ = true;
+  this->learn_refresh_(mode, elapsed);
+  return true;
 }
 
-void SSD1680EPaper::display_frame_() {
-  ESP_LOGD(TAG, "Writing frame to display");
+uint8_t SSD1680EPaper::temperature_band_() const {
+  // Unknown temperature counts as room temperature
+  if (std::isnan(this->temperature_))
+    return 2;
+  uint8_t band = 0;
+  while (band < TEMP_BANDS - 1 && this->temperature_ >= TEMP_BAND_LIMITS[band])
+    band++;
+  return band;
+}
+
+void SSD1680EPaper::learn_refresh_(uint8_t mode, uint32_t elapsed) {
+  if (!this->adaptive_timeout_)
+    return;
+  // Moving average weighted 3:1 towards history, so one slow refresh doesn't
+  // throw the estimate off
+  uint16_t &learned = this->learned_refresh_ms_[mode][this->temperature_band_()];
+  uint32_t sample = std::min<uint32_t>(elapsed, UINT16_MAX);
+  learned = learned == 0 ? sample : (learned * 3 + sample) / 4;
+}
+
+uint32_t SSD1680EPaper::refresh_timeout_() const {
+  const uint8_t mode = this->frame_partial_ ? 1 : 0;
+  const uint32_t ceiling = mode ? PARTIAL_REFRESH_TIMEOUT_MS : FULL_REFRESH_TIMEOUT_MS;
+  if (!this->adaptive_timeout_ || !this->busy_unreliable_[mode])
+    return ceiling;
   
-  // Hardware reset to recover from any stuck state
-  if (this->reset_pin_ != nullptr) {
-    this->reset_pin_->digital_write(false);
-    delay(10);
-    this->reset_pin_->digital_write(true);
-    delay(10);
+  // BUSY timed out last time in this mode, so it will likely stay HIGH again.
+  // Expect the duration learned for this temperature, else the slowest one
+  // learned in any band, else the fixed no-BUSY estimate.
+  uint32_t expected = this->learned_refresh_ms_[mode][this->temperature_band_()];
+  if (expected == 0) {
+    for (uint8_t band = 0; band < TEMP_BANDS; band++)
+      expected = std::max<uint32_t>(expected, this->learned_refresh_ms_[mode][band]);
   }
+  if (expected == 0)
+    expected = mode ? NO_BUSY_PARTIAL_REFRESH_MS : NO_BUSY_FULL_REFRESH_MS;
+  return std::min(ceiling, expected + expected / 4 + REFRESH_MARGIN_MS);
+}
+
+void SSD1680EPaper::set_ram_window_(const RamWindow &window) {
+  // Windows are in buffer coordinates, hardware rotation mirrors them
+  set_ram_window(*this, window, ROW_BYTES, HEIGHT, this->ram_rotated_);
+}
+
+void SSD1680EPaper::diff_frame_() {
+  // Both buffers come from the heap and hold a whole number of words
+  this->diff_bytes_ = diff_rows(this->buffer_, this->previous_buffer_, ROW_BYTES, HEIGHT, this->dirty_,
+                                this->diff_rows_, &this->diff_window_);
+}
+
+void SSD1680EPaper::split_regions_() {
+  this->frame_region_count_ = split_regions(this->diff_rows_, this->frame_window_, this->frame_regions_);
+}
+
+void SSD1680EPaper::display_frame_() {
+  ESP_LOGD(TAG, "Writing frame to display");
+  this->frame_start_ = millis();
+  this->busy_wait_ms_ = 0;
   
-  // Wait for display to be ready after reset
-  this->wait_until_idle_();
-  
-  // Re-send minimal init commands
-  this->command_(0x12);  // SW reset
-  delay(10);
-  this->wait_until_idle_();
+  // In partial mode the first frame and every Nth frame after that still do
+  // a full refresh to clear ghosting
+  this->frame_partial_ = this->refresh_mode_ == REFRESH_MODE_PARTIAL && this->at_update_ != 0 &&
+                         (this->controller_.red_ram == RED_RAM_PREVIOUS_FRAME || this->rtc_frame_valid_());
   
-  // Driver output control
-  this->command_(0x01);
-  this->data_(0x27);  // 296 - 1 = 0x127, low byte
-  this->data_(0x01);  // high byte
-  this->data_(0x00);  // GD=0, SM=0, TB=0
+  // With dirty tracking, RAM 0x24 still holds previous_buffer_, so only the
+  // bytes that changed since then need to be sent
+  this->frame_window_ = FULL_WINDOW;
+  this->frame_regions_[0] = FULL_WINDOW;
+  this->frame_region_count_ = 1;
+  if (this->dirty_tracking_ && this->bw_ram_valid_) {
+    this->frame_window_ = this->diff_window_;
+    this->split_regions_();
+  }
   
-  // Data entry mode
-  this->command_(0x11);
-  this->data_(0x03);  // X inc, Y inc
+  // In persistent init mode the controller keeps its configuration between
+  // frames, so only a detected fault (or a fresh boot, e.g. after deep
+  // sleep) goes through the reset sequence again
+  if (!this->controller_.needs_reset(this->persistent_init_)) {
+    this->state_ = FRAME_STATE_WRITE_RAM;
+    return;
+  }
   
-  // Set RAM X address
-  this->command_(0x44);
-  this->data_(0x00);
-  this->data_(0x0F);  // 16 bytes = 128 pixels
+  // Power the panel back up, reset is held below while the supply settles
+  uint32_t reset_ms = 10;
+  if (!this->panel_powered_) {
+    this->panel_power_(true);
+    reset_ms = PANEL_POWER_ON_MS;
+  }
   
-  // Set RAM Y address  
-  this->command_(0x45);
-  this->data_(0x00);
-  this->data_(0x00);
-  this->data_(0x27);
-  this->data_(0x01);
+  // Hardware reset to recover from any stuck state (and to leave deep sleep)
+  this->arm_busy_();
+  begin_reset(*this, this->controller_, this->reset_pin_ != nullptr);
+  if (this->reset_pin_ != nullptr) {
+    this->wait_start_ = millis();
+    this->wait_min_ms_ = reset_ms;
+    this->state_ = FRAME_STATE_RESET_LOW;
+  } else {
+    this->sequence_pos_ = 0;
+    this->wait_idle_then_(FRAME_STATE_INIT_SEQUENCE, reset_ms);
+  }
+}
+
+void SSD1680EPaper::loop() {
+#ifdef SSD1680_EPAPER_WORKER_TASK
+  if (this->worker_running_()) {
+    if (this->worker_frame_ && !this->is_refreshing()) {
+      this->worker_frame_ = false;
+      this->publish_timings_();
+    }
+    if (this->handoff_pending_ && this->refresh_allowed_()) {
+      this->handoff_frame_();
+    }
+    return;
+  }
+#endif
   
-  // Set RAM address counters
-  this->command_(0x4E);
-  this->data_(0x00);
-  this->command_(0x4F);
-  this->data_(0x00);
-  this->data_(0x00);
+  // Advance through as many steps as possible, stop at the first one that
+  // has to wait for time to pass or for BUSY
+  while (this->state_ != FRAME_STATE_IDLE && this->run_state_()) {
+  }
   
-  // Write B/W RAM (0x24) - INVERT data for correct polarity
-  // This display: 0xFF = black, 0x00 = white (confirmed by testing)
-  // ESPHome buffer: bits set = foreground (COLOR_ON), cleared = background
-  // We need to invert so drawing shows up correctly
-  this->command_(0x24);
-  for (uint32_t i = 0; i < ALLSCREEN_BYTES; i++) {
-    this->data_(~this->buffer_[i]);  // INVERTED for correct polarity
+  if (this->update_pending_ && this->refresh_allowed_()) {
+    ESP_LOGD(TAG, "Rendering pending update (%u requests coalesced)", (unsigned) this->coalesced_updates_);
+    this->update();
+  }
+}
+
+bool SSD1680EPaper::is_refreshing() const {
+#ifdef SSD1680_EPAPER_WORKER_TASK
+  if (this->worker_running_())
+    return this->worker_busy_.load(std::memory_order_acquire);
+#endif
+  return this->state_ != FRAME_STATE_IDLE;
+}
+
+#ifdef SSD1680_EPAPER_WORKER_TASK
+void SSD1680EPaper::handoff_frame_() {
+  // The worker is idle, so the pipeline state and the shadow buffer are safe
+  // to set up from the main loop
+  this->handoff_pending_ = false;
+  if (!this->submit_frame_())
+    return;
+  memcpy(this->frame_buffer_, this->buffer_, this->buffer_bytes_());
+  this->worker_frame_ = true;
+  this->worker_busy_.store(true, std::memory_order_release);
+  xTaskNotifyGive(this->worker_handle_);
+}
+
+void SSD1680EPaper::worker_loop_(void *arg) {
+  auto *self = static_cast<SSD1680EPaper *>(arg);
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // Same steps as loop(), a step that has to wait sleeps for a tick
+    while (self->state_ != FRAME_STATE_IDLE) {
+      if (!self->run_state_())
+        vTaskDelay(1);
+    }
+    self->worker_busy_.store(false, std::memory_order_release);
+  }
+}
+#endif
+
+bool SSD1680EPaper::refresh_allowed_() const {
+  if (this->is_refreshing())
+    return false;
+  // frame_start_ is only meaningful once the first frame went out
+  return !this->initialized_ || millis() - this->frame_start_ >= this->min_refresh_interval_;
+}
+
+bool SSD1680EPaper::run_state_() {
+  switch (this->state_) {
+    case FRAME_STATE_IDLE:
+      return false;
+    
+    case FRAME_STATE_WAIT_IDLE:
+      if (!this->wait_idle_done_())
+        return false;
+      this->state_ = this->next_state_;
+      return true;
+    
+    case FRAME_STATE_RESET_LOW:
+      if (millis() - this->wait_start_ < this->wait_min_ms_)
+        return false;
+      this->reset(false);
+      // Wait for display to be ready after reset
+      this->sequence_pos_ = 0;
+      this->wait_idle_then_(FRAME_STATE_INIT_SEQUENCE, 10);
+      return true;
+    
+    case FRAME_STATE_INIT_SEQUENCE: {
+      // Re-send the init table, pausing at its wait markers
+      uint32_t delay_ms = 0;
+      if (this->play_sequence_(INIT_SEQUENCE, sizeof(INIT_SEQUENCE), &this->sequence_pos_, &delay_ms)) {
+        this->wait_idle_then_(FRAME_STATE_INIT_SEQUENCE, delay_ms);
+        return true;
+      }
+      this->configure_();
+      this->controller_.ready = true;
+      this->state_ = FRAME_STATE_WRITE_RAM;
+      return true;
+    }
+    
+    case FRAME_STATE_WRITE_RAM:
+      this->write_frame_();
+      this->state_ = FRAME_STATE_TRANSFER;
+      return true;
+    
+    case FRAME_STATE_TRANSFER:
+      if (!this->transfer_step_())
+        return false;
+      ESP_LOGD(TAG, "RAM transfer: %u bytes (B/W x %u-%u, y %u-%u, %u windows) in %lu us",
+               (unsigned) this->writer_.bytes(), this->frame_window_.x_start, this->frame_window_.x_end,
+               this->frame_window_.y_start, this->frame_window_.y_end, this->frame_region_count_, this->transfer_us_);
+      this->frame_transfer_us_ = this->transfer_us_;
+      this->wait_idle_then_(FRAME_STATE_REFRESH, 0);
+      return true;
+    
+    case FRAME_STATE_REFRESH:
+      ESP_LOGD(TAG, "Frame written, starting %s update", this->frame_partial_ ? "partial" : "full");
+      if (this->frame_partial_) {
+        this->partial_update_();
+      } else {
+        this->full_update_();
+      }
+      this->refresh_start_ = millis();
+      this->state_ = FRAME_STATE_REFRESH_WAIT;
+      return false;
+    
+    case FRAME_STATE_REFRESH_WAIT:
+      if (!this->refresh_done_())
+        return false;
+      this->write_reference_();
+      this->state_ = FRAME_STATE_REFERENCE;
+      return true;
+    
+    case FRAME_STATE_REFERENCE:
+      if (!this->transfer_step_())
+        return false;
+      this->finish_frame_();
+      this->state_ = FRAME_STATE_IDLE;
+      return false;
+  }
+  return false;
+}
+
+void SSD1680EPaper::configure_() {
+  // Data entry mode, the only setup that isn't fixed per panel
+  this->command(0x11, this->data_entry_mode_());
+}
+
+uint8_t SSD1680EPaper::data_entry_mode_() const {
+  // 0x03 = X inc, Y inc. With hardware rotation both counters run backwards
+  // (0x00), so the buffer is streamed in drawing order and lands rotated.
+  return this->ram_rotated_ ? 0x00 : 0x03;
+}
+
+void SSD1680EPaper::write_frame_() {
+  // The benchmark switches refresh_mode_, so it is handed over per frame
+  this->writer_.set_red_ram(this->refresh_mode_ == REFRESH_MODE_PARTIAL, this->red_ram_write_once_);
+  const uint8_t *restore = nullptr;
+#ifdef SSD1680_EPAPER_RTC_FRAME
+  // The reference plane was lost (power cut or MCU deep sleep), the frame
+  // the panel still shows can be put back so this frame can be partial
+  restore = rtc_frame;
+#endif
+  this->writer_.write_frame(this->controller_, this->frame_buffer_, this->frame_regions_, this->frame_region_count_,
+                            this->frame_partial_, restore);
+  this->transfer_us_ = 0;
+}
+
+void SSD1680EPaper::write_reference_() {
+  this->writer_.write_reference(this->controller_);
+  this->transfer_us_ = 0;
+}
+
+void SSD1680EPaper::finish_frame_() {
+  if (this->refresh_mode_ == REFRESH_MODE_PARTIAL) {
+    this->at_update_ = (this->at_update_ + 1) % this->full_update_every_;
   }
   
-  // Write RED RAM (0x26) - all 0x00 to not interfere
-  this->command_(0x4E);
-  this->data_(0x00);
-  this->command_(0x4F);
-  this->data_(0x00);
-  this->data_(0x00);
+  if (this->dirty_tracking_) {
+    memcpy(this->previous_buffer_, this->frame_buffer_, ALLSCREEN_BYTES);
+    this->bw_ram_valid_ = true;
+  }
+  // After a timeout the panel may not show this frame, so the next one must
+  // not be skipped as unchanged
+  this->last_frame_hash_ = this->frame_hash_;
+  this->last_frame_valid_ = this->frame_refreshed_;
+  this->frame_transfer_us_ += this->transfer_us_;
+  ESP_LOGD(TAG, "Display update complete in %lu ms", millis() - this->frame_start_);
+  // Sensors are published from the main loop, see loop()
+  if (!this->worker_running_()) {
+    this->publish_timings_();
+  }
   
-  this->command_(0x26);
-  for (uint32_t i = 0; i < ALLSCREEN_BYTES; i++) {
-    this->data_(0x00);
+  if (this->low_power_) {
+    this->enter_low_power_();
+  }
+}
+
+void SSD1680EPaper::publish_timings_() {
+#ifdef USE_SENSOR
+  if (this->render_time_sensor_ != nullptr)
+    this->render_time_sensor_->publish_state(this->render_us_ / 1000.0f);
+  if (this->transfer_time_sensor_ != nullptr)
+    this->transfer_time_sensor_->publish_state(this->frame_transfer_us_ / 1000.0f);
+  if (this->busy_wait_time_sensor_ != nullptr)
+    this->busy_wait_time_sensor_->publish_state(this->busy_wait_ms_);
+  if (this->refresh_time_sensor_ != nullptr)
+    this->refresh_time_sensor_->publish_state(this->refresh_ms_);
+  if (this->busy_timeouts_sensor_ != nullptr)
+    this->busy_timeouts_sensor_->publish_state(this->busy_timeouts_);
+  if (this->skipped_frames_sensor_ != nullptr)
+    this->skipped_frames_sensor_->publish_state(this->skipped_frames_);
+#endif
+}
+
+bool SSD1680EPaper::rtc_frame_valid_() const {
+#ifdef SSD1680_EPAPER_RTC_FRAME
+  return rtc_frame_tag == this->rtc_frame_tag_();
+#else
+  return false;
+#endif
+}
+
+uint32_t SSD1680EPaper::rtc_frame_tag_() const {
+  // A frame saved with another buffer layout can't serve as the reference
+  return RTC_FRAME_MAGIC ^ (uint32_t(SSD1680_EPAPER_MODEL) << 8) ^ (uint32_t(this->native_polarity_) << 16) ^
+         (uint32_t(this->ram_rotated_) << 17) ^ (uint32_t(this->grayscale_) << 18);
+}
+
+// The only GPIO the driver drives directly, everything else goes through
+// the configured pins and the SPI device
+void SSD1680EPaper::panel_power_(bool on) {
+  if (on) {
+    gpio_hold_dis(PANEL_POWER_PIN);
+    gpio_set_level(PANEL_POWER_PIN, 1);
+  } else {
+    // Hold the pin LOW through MCU deep sleep too
+    gpio_set_level(PANEL_POWER_PIN, 0);
+    gpio_hold_en(PANEL_POWER_PIN);
   }
+  this->panel_powered_ = on;
+}
+
+void SSD1680EPaper::enter_low_power_() {
+#ifdef SSD1680_EPAPER_RTC_FRAME
+  memcpy(rtc_frame, this->frame_buffer_, ALLSCREEN_BYTES);
+  rtc_at_update = this->at_update_;
+  rtc_frame_tag = this->rtc_frame_tag_();
+#endif
   
-  this->wait_until_idle_();
+  // Deep sleep mode 1 keeps RAM, leaving it again needs a HW reset, so the
+  // next frame always goes through the reset sequence
+  this->command(0x10, 0x01);
+  this->controller_.ready = false;
   
-  ESP_LOGD(TAG, "Frame written, starting update");
-  this->full_update_();
-  ESP_LOGD(TAG, "Display update complete");
+  if (this->cut_panel_power_) {
+    this->panel_power_(false);
+    this->controller_.red_ram = RED_RAM_UNKNOWN;
+    this->bw_ram_valid_ = false;
+  }
+  ESP_LOGD(TAG, "Controller in deep sleep%s", this->cut_panel_power_ ? ", panel power off" : "");
 }
 
 void SSD1680EPaper::update() {
+  // The buffer is still being sent to the panel, drawing into it now would
+  // corrupt the frame in flight. Render once the panel is free instead, with
+  // whatever the lambda draws by then, so a burst of requests costs a single
+  // extra refresh. The worker task sends its own copy, so there only the
+  // handoff waits.
+  if (!this->worker_running_() && !this->refresh_allowed_()) {
+    if (this->update_pending_) {
+      this->coalesced_updates_++;
+    } else {
+      ESP_LOGD(TAG, "%s, deferring update", this->is_refreshing() ? "Refresh in progress" : "Minimum refresh interval");
+      this->update_pending_ = true;
+      this->coalesced_updates_ = 1;
+    }
+    return;
+  }
+  this->update_pending_ = false;
+  
+  // Low power wake: no diagnostics and no blocking init, the frame pipeline
+  // resets and configures the controller without stalling loop()
+  if (!this->initialized_ && this->low_power_) {
+    this->initialized_ = true;
+  }
+  
   if (!this->initialized_) {
-    ESP_LOGI(TAG, "");
-    ESP_LOGI(TAG, "========================================");
-    ESP_LOGI(TAG, "  FIRST UPDATE - INITIALIZING DISPLAY");
-    ESP_LOGI(TAG, "  VERSION 3 - Pin swap detection");
-    ESP_LOGI(TAG, "========================================");
-    ESP_LOGI(TAG, "Configured pins: CS=45, DC=46, RST=47, BUSY=48");
-    ESP_LOGI(TAG, "SPI: CLK=12, MOSI=11");
-    
-    // Test: Try reading GPIO47 as input to see if BUSY/RESET are swapped
-    ESP_LOGI(TAG, "");
-    ESP_LOGI(TAG, "=== PIN SWAP TEST ===");
-    ESP_LOGI(TAG, "Reading GPIO48 (configured as BUSY): %d", this->busy_pin_->digital_read());
-    
-    // Temporarily configure GPIO47 as input to read it
-    gpio_config_t io_conf = {};
-    io_conf.pin_bit_mask = (1ULL << 47);
-    io_conf.mode = GPIO_MODE_INPUT;
-    io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
-    io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
-    gpio_config(&io_conf);
-    ESP_LOGI(TAG, "Reading GPIO47 (configured as RESET, now input): %d", gpio_get_level(GPIO_NUM_47));
-    
-    // Restore GPIO47 as output for reset
-    io_conf.mode = GPIO_MODE_OUTPUT;
-    gpio_config(&io_conf);
-    gpio_set_level(GPIO_NUM_47, 1);  // Keep high (not in reset)
-    ESP_LOGI(TAG, "=== END PIN SWAP TEST ===");
-    ESP_LOGI(TAG, "");
+    if (this->diagnostics_) {
+      this->pin_swap_test_();
+    }
     
     this->init_display_();
+    
+    // A SW reset that never completes usually means the commands were garbled
+    // on the bus, retry once at the known-good rate
+    if (!this->controller_.ready && this->data_rate_ > FALLBACK_DATA_RATE) {
+      ESP_LOGW(TAG, "Init failed at %u kHz, retrying at %u kHz", (unsigned) (this->data_rate_ / 1000),
+               (unsigned) (FALLBACK_DATA_RATE / 1000));
+      this->spi_teardown();
+      this->set_data_rate(FALLBACK_DATA_RATE);
+      this->spi_setup();
+      this->init_display_();
+    }
     this->initialized_ = true;
     
-    ESP_LOGI(TAG, "========================================");
-    ESP_LOGI(TAG, "  INITIALIZATION COMPLETE");
-    ESP_LOGI(TAG, "========================================");
-    ESP_LOGI(TAG, "");
+    if (this->diagnostics_) {
+      ESP_LOGI(TAG, "========================================");
+      ESP_LOGI(TAG, "  INITIALIZATION COMPLETE");
+      ESP_LOGI(TAG, "========================================");
+      ESP_LOGI(TAG, "");
+    }
   }
   
+  uint32_t render_start = micros();
   this->do_update_();
+  this->render_us_ = micros() - render_start;
+  
+#ifdef SSD1680_EPAPER_WORKER_TASK
+  if (this->worker_running_()) {
+    this->handoff_pending_ = true;
+    if (this->refresh_allowed_())
+      this->handoff_frame_();
+    return;
+  }
+#endif
+  this->submit_frame_();
+}
+
+bool SSD1680EPaper::submit_frame_() {
+  // One diff against the shadow copy serves skip_unchanged, the RAM window
+  // and the partial-refresh reference alike
+  if (this->dirty_tracking_ && this->bw_ram_valid_) {
+    this->diff_frame_();
+    ESP_LOGV(TAG, "Frame diff: %u bytes changed", (unsigned) this->diff_bytes_);
+  }
+  
+  if (this->skip_unchanged_ && this->frame_unchanged_()) {
+    this->skipped_frames_++;
+    ESP_LOGD(TAG, "Frame unchanged, skipping refresh (%u skipped so far)", (unsigned) this->skipped_frames_);
+#ifdef USE_SENSOR
+    if (this->skipped_frames_sensor_ != nullptr)
+      this->skipped_frames_sensor_->publish_state(this->skipped_frames_);
+#endif
+    return false;
+  }
+  
+  // Drawing from here on goes into the next frame
+  this->dirty_ = EMPTY_WINDOW;
   this->display_frame_();
+  return true;
 }
 
+void SSD1680EPaper::run_benchmark(uint32_t iterations, uint32_t refreshes, display::BaseFont *font) {
+  if (!this->initialized_ || this->is_refreshing()) {
+    ESP_LOGW(TAG, "Benchmark needs an initialized, idle display, skipping");
+    return;
+  }
+  iterations = std::max<uint32_t>(iterations, 1);
+  ESP_LOGI(TAG, "Benchmark: %u iterations, %u refreshes per mode, SPI at %u kHz", (unsigned) iterations,
+           (unsigned) refreshes, (unsigned) (this->data_rate_ / 1000));
+  uint32_t start = micros();
+  for (uint32_t i = 0; i < iterations; i++) {
+    this->fill((i & 1) ? COLOR_ON : COLOR_OFF);
+  }
+  ESP_LOGI(TAG, "  fill(): %u us", (unsigned) ((micros() - start) / iterations));
+  App.feed_wdt();
+  
+  // Through draw_pixel_at() like a lambda, so rotation and clipping count
+  const display::DisplayRotation rotation = this->rotation_;
+  for (auto r : {display::DISPLAY_ROTATION_0_DEGREES, display::DISPLAY_ROTATION_90_DEGREES,
+                 display::DISPLAY_ROTATION_180_DEGREES, display::DISPLAY_ROTATION_270_DEGREES}) {
+    this->rotation_ = r;
+    const int w = this->get_width();
+    const int h = this->get_height();
+    start = micros();
+    for (uint32_t i = 0; i < iterations; i++) {
+      int x = 0;
+      int y = 0;
+      for (uint32_t p = 0; p < BENCHMARK_PIXELS; p++) {
+        this->draw_pixel_at(x, y, (p & 1) ? COLOR_ON : COLOR_OFF);
+        if (++x == w)
+          x = 0;
+        y += 7;
+        if (y >= h)
+          y -= h;
+      }
+      App.feed_wdt();
+    }
+    ESP_LOGI(TAG, "  %u pixels at %u degrees: %u us", (unsigned) BENCHMARK_PIXELS, (unsigned) r,
+             (unsigned) ((micros() - start) / iterations));
+  }
+  this->rotation_ = rotation;
+  
+  if (font != nullptr) {
+    start = micros();
+    for (uint32_t i = 0; i < iterations; i++) {
+      this->print(0, 0, font, COLOR_ON, display::TextAlign::TOP_LEFT, BENCHMARK_TEXT);
+    }
+    ESP_LOGI(TAG, "  print(\"%s\"): %u us", BENCHMARK_TEXT, (unsigned) ((micros() - start) / iterations));
+    App.feed_wdt();
+  }
+  
+  // One B/W plane through the staging path a frame uses. RAM 0x24 no longer
+  // matches the shadow copy afterwards.
+  uint32_t transfer_us = 0;
+  uint32_t transfer_bytes = 0;
+  for (uint32_t i = 0; i < iterations; i++) {
+    this->writer_.write_plane(0x24, FULL_WINDOW, this->frame_buffer_);
+    this->transfer_us_ = 0;
+    while (!this->transfer_step_()) {
+    }
+    transfer_us += this->transfer_us_;
+    transfer_bytes += this->writer_.bytes();
+  }
+  this->bw_ram_valid_ = false;
+  const uint32_t rate = uint64_t(transfer_bytes) * 1000 / std::max<uint32_t>(transfer_us, 1);
+  ESP_LOGI(TAG, "  SPI plane push: %u bytes in %u us (%u kB/s)", (unsigned) (transfer_bytes / iterations),
+           (unsigned) (transfer_us / iterations), (unsigned) rate);
+  App.feed_wdt();
+  
+  // Refreshes end to end, from reset (or persistent init) to the reference
+  // write. Partial needs a reference frame in RED RAM first.
+  const RefreshMode refresh_mode = this->refresh_mode_;
+  const uint32_t at_update = this->at_update_;
+  const uint32_t full_update_every = this->full_update_every_;
+  this->refresh_mode_ = REFRESH_MODE_FULL;
+  for (uint32_t i = 0; i < refreshes; i++) {
+    uint32_t ms = this->benchmark_frame_();
+    ESP_LOGI(TAG, "  Full refresh: %u ms (SPI %u us, refresh %u ms)", (unsigned) ms,
+             (unsigned) this->frame_transfer_us_, (unsigned) this->refresh_ms_);
+  }
+  if (refreshes > 0 && !this->grayscale_) {
+    this->refresh_mode_ = REFRESH_MODE_PARTIAL;
+    this->full_update_every_ = UINT32_MAX;
+    this->at_update_ = 0;
+    this->benchmark_frame_();
+    for (uint32_t i = 0; i < refreshes; i++) {
+      this->fill((i & 1) ? COLOR_ON : COLOR_OFF);
+      uint32_t ms = this->benchmark_frame_();
+      ESP_LOGI(TAG, "  Partial refresh: %u ms (SPI %u us, refresh %u ms)", (unsigned) ms,
+               (unsigned) this->frame_transfer_us_, (unsigned) this->refresh_ms_);
+    }
+  }
+  this->refresh_mode_ = refresh_mode;
+  this->at_update_ = at_update;
+  this->full_update_every_ = full_update_every;
+  
+  // Put the real frame back
+  ESP_LOGI(TAG, "Benchmark done");
+  this->update();
+}
+
+uint32_t SSD1680EPaper::benchmark_frame_() {
+  // Runs one frame through the pipeline synchronously. The worker task, if
+  // any, is idle and stays blocked until the next handoff.
+  if (this->frame_buffer_ != this->buffer_) {
+    memcpy(this->frame_buffer_, this->buffer_, this->buffer_bytes_());
+  }
+  // The panel ends up showing the benchmark pattern, so the next real frame
+  // must not be skipped as unchanged nor diffed against the old RAM content
+  this->bw_ram_valid_ = false;
+  this->last_frame_valid_ = false;
+  this->dirty_ = EMPTY_WINDOW;
+  uint32_t start = millis();
+  this->display_frame_();
+  while (this->state_ != FRAME_STATE_IDLE) {
+    if (!this->run_state_()) {
+      App.feed_wdt();
+      delay(1);
+    }
+  }
+  return millis() - start;
+}
+
+// Reads back the RESET line to spot boards with BUSY and RESET swapped
+void SSD1680EPaper::pin_swap_test_() {
+  ESP_LOGI(TAG, "");
+  ESP_LOGI(TAG, "========================================");
+  ESP_LOGI(TAG, "  FIRST UPDATE - INITIALIZING DISPLAY");
+  ESP_LOGI(TAG, "  VERSION 3 - Pin swap detection");
+  ESP_LOGI(TAG, "========================================");
+  ESP_LOGI(TAG, "Configured pins: CS=45, DC=46, RST=47, BUSY=48");
+  ESP_LOGI(TAG, "SPI: CLK=12, MOSI=11");
+  
+  // Test: Try reading GPIO47 as input to see if BUSY/RESET are swapped
+  ESP_LOGI(TAG, "");
+  ESP_LOGI(TAG, "=== PIN SWAP TEST ===");
+  if (this->busy_pin_ != nullptr) {
+    ESP_LOGI(TAG, "Reading GPIO48 (configured as BUSY): %d", this->busy_pin_->digital_read());
+  }
+  
+  // Temporarily configure GPIO47 as input to read it
+  gpio_config_t io_conf = {};
+  io_conf.pin_bit_mask = (1ULL << PIN_SWAP_TEST_PIN);
+  io_conf.mode = GPIO_MODE_INPUT;
+  io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
+  io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+  gpio_config(&io_conf);
+  ESP_LOGI(TAG, "Reading GPIO47 (configured as RESET, now input): %d", gpio_get_level(PIN_SWAP_TEST_PIN));
+  
+  // Restore GPIO47 as output for reset
+  io_conf.mode = GPIO_MODE_OUTPUT;
+  gpio_config(&io_conf);
+  gpio_set_level(PIN_SWAP_TEST_PIN, 1);  // Keep high (not in reset)
+  ESP_LOGI(TAG, "=== END PIN SWAP TEST ===");
+  ESP_LOGI(TAG, "");
+}
+
+bool SSD1680EPaper::frame_unchanged_() {
+  // With dirty tracking the previous frame is already in memory, so compare
+  // against it directly. Otherwise fall back to a hash of the whole buffer.
+  if (this->dirty_tracking_) {
+    if (!this->bw_ram_valid_ || !this->last_frame_valid_)
+      return false;
+    if (!this->diff_window_.is_empty())
+      return false;
+    this->dirty_ = EMPTY_WINDOW;
+    return true;
+  }
+  
+  // FNV-1a
+  uint32_t hash = 2166136261UL;
+  const size_t len = this->buffer_bytes_();
+  for (size_t i = 0; i < len; i++) {
+    hash ^= this->buffer_[i];
+    hash *= 16777619UL;
+  }
+  // Kept by finish_frame_(), if this frame gets refreshed successfully
+  this->frame_hash_ = hash;
+  return this->last_frame_valid_ && hash == this->last_frame_hash_;
+}
+
+size_t SSD1680EPaper::buffer_bytes_() const { return this->grayscale_ ? ALLSCREEN_BYTES * 2 : ALLSCREEN_BYTES; }
+
 void SSD1680EPaper::draw_absolute_pixel_internal(int x, int y, Color color) {
-  if (x < 0 || x >= this->get_width_internal() || y < 0 || y >= this->get_height_internal())
+  if (x < 0 || x >= WIDTH || y < 0 || y >= HEIGHT)
     return;
-    
-  uint32_t pos = (y * (WIDTH / 8)) + (x / 8);
-  uint8_t bit = 0x80 >> (x % 8);
   
-  if (pos >= ALLSCREEN_BYTES)
+  if (this->grayscale_) {
+    set_gray_pixel(this->buffer_, GRAY_ROW_BYTES, x, y, gray_level(color.r, color.g, color.b, color.w));
+    return;
+  }
+  
+  // In native polarity the buffer holds panel bits directly (0 = black)
+  set_pixel(this->buffer_, ROW_BYTES, x, y, color.is_on() != this->native_polarity_);
+  
+  if (this->dirty_tracking_) {
+    uint8_t xb = x / 8;
+    if (xb < this->dirty_.x_start)
+      this->dirty_.x_start = xb;
+    if (xb > this->dirty_.x_end)
+      this->dirty_.x_end = xb;
+    if (y < this->dirty_.y_start)
+      this->dirty_.y_start = y;
+    if (y > this->dirty_.y_end)
+      this->dirty_.y_end = y;
+  }
+}
+
+void SSD1680EPaper::fill(Color color) {
+  // A clipped fill only covers the clipping rectangle
+  if (this->is_clipping()) {
+    this->fill_rect(0, 0, this->get_width(), this->get_height(), color);
+    return;
+  }
+  
+  if (this->grayscale_) {
+    memset(this->buffer_, gray_level(color.r, color.g, color.b, color.w) * 0x55, this->buffer_bytes_());
+    return;
+  }
+  memset(this->buffer_, (color.is_on() != this->native_polarity_) ? 0xFF : 0x00, ALLSCREEN_BYTES);
+  if (this->dirty_tracking_) {
+    this->dirty_ = FULL_WINDOW;
+  }
+}
+
+void SSD1680EPaper::horizontal_span(int x, int y, int width, Color color) { this->fill_rect(x, y, width, 1, color); }
+
+void SSD1680EPaper::fill_rect(int x, int y, int width, int height, Color color) {
+  // Clip in drawing coordinates, like draw_pixel_at() does per pixel
+  int x1 = x + width;
+  int y1 = y + height;
+  if (this->is_clipping()) {
+    display::Rect clip = this->get_clipping();
+    x = std::max<int>(x, clip.x);
+    y = std::max<int>(y, clip.y);
+    x1 = std::min<int>(x1, clip.x + clip.w);
+    y1 = std::min<int>(y1, clip.y + clip.h);
+  }
+  x = std::max(x, 0);
+  y = std::max(y, 0);
+  x1 = std::min(x1, this->get_width());
+  y1 = std::min(y1, this->get_height());
+  if (x >= x1 || y >= y1)
+    return;
+  
+  int ax0, ay0, ax1, ay1;
+  to_absolute_rect(this->rotation_, WIDTH, HEIGHT, x, y, x1, y1, &ax0, &ay0, &ax1, &ay1);
+  if (this->grayscale_) {
+    // The byte-granular fills only know the 1-bpp layout
+    for (int py = ay0; py <= ay1; py++) {
+      for (int px = ax0; px <= ax1; px++) {
+        this->draw_absolute_pixel_internal(px, py, color);
+      }
+    }
     return;
-    
-  if (color.is_on()) {
-    this->buffer_[pos] |= bit;
-  } else {
-    this->buffer_[pos] &= ~bit;
   }
+  fill_rect_absolute(this->buffer_, ROW_BYTES, ax0, ay0, ax1, ay1, color.is_on() != this->native_polarity_);
+  this->mark_dirty_(ax0, ay0, ax1, ay1);
+}
+
+void SSD1680EPaper::mark_dirty_(int x0, int y0, int x1, int y1) {
+  if (!this->dirty_tracking_)
+    return;
+  this->dirty_.x_start = std::min<uint8_t>(this->dirty_.x_start, x0 / 8);
+  this->dirty_.x_end = std::max<uint8_t>(this->dirty_.x_end, x1 / 8);
+  this->dirty_.y_start = std::min<uint16_t>(this->dirty_.y_start, y0);
+  this->dirty_.y_end = std::max<uint16_t>(this->dirty_.y_end, y1);
+}
+
+void SSD1680EPaper::draw_bitmap(int x, int y, int width, int height, const uint8_t *bitmap, Color color,
+                                bool transparent) {
+  if (width <= 0 || height <= 0)
+    return;
+  const int stride = (width + 7) / 8;
+  
+  // The span path only handles fully visible bitmaps in the 1-bpp layout,
+  // anything touching the clipping rectangle or the panel edge, and any
+  // grayscale frame, goes pixel by pixel
+  bool visible = !this->grayscale_ && x >= 0 && y >= 0 && x + width <= this->get_width() &&
+                 y + height <= this->get_height();
+  if (visible && this->is_clipping()) {
+    display::Rect clip = this->get_clipping();
+    visible = x >= clip.x && y >= clip.y && x + width <= clip.x + clip.w && y + height <= clip.y + clip.h;
+  }
+  if (!visible) {
+    Color off = color.is_on() ? COLOR_OFF : COLOR_ON;
+    for (int r = 0; r < height; r++) {
+      const uint8_t *src = bitmap + r * stride;
+      for (int c = 0; c < width; c++) {
+        bool on = src[c / 8] & (0x80 >> (c % 8));
+        if (on || !transparent)
+          this->draw_pixel_at(x + c, y + r, on ? color : off);
+      }
+    }
+    return;
+  }
+  
+  blit_bitmap(this->buffer_, ROW_BYTES, WIDTH, HEIGHT, this->rotation_, x, y, width, height, bitmap,
+              color.is_on() != this->native_polarity_, transparent);
+  
+  int ax0, ay0, ax1, ay1;
+  to_absolute_rect(this->rotation_, WIDTH, HEIGHT, x, y, x + width, y + height, &ax0, &ay0, &ax1, &ay1);
+  this->mark_dirty_(ax0, ay0, ax1, ay1);
 }
 
 }  // namespace ssd1680_epaper
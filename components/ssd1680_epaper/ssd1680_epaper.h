@@ -1,47 +1,362 @@
 #pragma once
 
+#include <cmath>
+#include "esphome/core/automation.h"
 #include "esphome/core/component.h"
+#include "esphome/core/defines.h"
 #include "esphome/components/spi/spi.h"
 #include "esphome/components/display/display_buffer.h"
+#include "frame_ops.h"
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
+#ifdef SSD1680_EPAPER_WORKER_TASK
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
 
 namespace esphome {
 namespace ssd1680_epaper {
 
+enum RefreshMode : uint8_t {
+  REFRESH_MODE_FULL = 0,
+  REFRESH_MODE_PARTIAL,
+};
+
+// LUT used for full refreshes, either the controller's OTP waveform or one
+// from the built-in library uploaded with 0x32
+enum Waveform : uint8_t {
+  WAVEFORM_OTP = 0,
+  WAVEFORM_FULL,
+  WAVEFORM_GRAY4,
+};
+
+struct WaveformTable;
+
+// Where a frame-sized buffer is allocated. Auto keeps ESPHome's default of
+// PSRAM when present, internal RAM otherwise.
+enum BufferLocation : uint8_t {
+  BUFFER_LOCATION_AUTO = 0,
+  BUFFER_LOCATION_INTERNAL,
+  BUFFER_LOCATION_PSRAM,
+};
+
+#ifndef SSD1680_EPAPER_MODEL
+#define SSD1680_EPAPER_MODEL PANEL_MODEL_2_90IN
+#endif
+static constexpr PanelGeometry PANEL = PANEL_GEOMETRIES[SSD1680_EPAPER_MODEL];
+
 // VERSION 2 - with deferred init
+// DATA_RATE_4MHZ is only the default, the data_rate option overrides it
 class SSD1680EPaper : public display::DisplayBuffer,
+                      public Transport,
                       public spi::SPIDevice<spi::BIT_ORDER_MSB_FIRST, spi::CLOCK_POLARITY_LOW,
                                            spi::CLOCK_PHASE_LEADING, spi::DATA_RATE_4MHZ> {
  public:
   void set_dc_pin(GPIOPin *dc_pin) { dc_pin_ = dc_pin; }
   void set_reset_pin(GPIOPin *reset_pin) { reset_pin_ = reset_pin; }
   void set_busy_pin(GPIOPin *busy_pin) { busy_pin_ = busy_pin; }
+  void set_busy_interrupt(bool busy_interrupt) { busy_interrupt_ = busy_interrupt; }
+  void set_red_ram_write_once(bool red_ram_write_once) { red_ram_write_once_ = red_ram_write_once; }
+  void set_refresh_mode(RefreshMode refresh_mode) { refresh_mode_ = refresh_mode; }
+  void set_full_update_every(uint32_t full_update_every) { full_update_every_ = full_update_every; }
+  void set_dirty_tracking(bool dirty_tracking) { dirty_tracking_ = dirty_tracking; }
+  void set_skip_unchanged(bool skip_unchanged) { skip_unchanged_ = skip_unchanged; }
+  void set_persistent_init(bool persistent_init) { persistent_init_ = persistent_init; }
+  void set_native_polarity(bool native_polarity) { native_polarity_ = native_polarity; }
+  void set_hardware_rotation(bool hardware_rotation) { hardware_rotation_ = hardware_rotation; }
+  void set_low_power(bool low_power) { low_power_ = low_power; }
+  void set_cut_panel_power(bool cut_panel_power) { cut_panel_power_ = cut_panel_power; }
+  void set_diagnostics(bool diagnostics) { diagnostics_ = diagnostics; }
+  void set_adaptive_timeout(bool adaptive_timeout) { adaptive_timeout_ = adaptive_timeout; }
+  // Ambient temperature in C, selects the band for learned refresh durations
+  void set_temperature(float temperature) { temperature_ = temperature; }
+  void set_waveform_cache(bool waveform_cache) { waveform_cache_ = waveform_cache; }
+  void set_waveform(Waveform waveform) { waveform_ = waveform; }
+  void set_grayscale(bool grayscale) { grayscale_ = grayscale; }
+  void set_worker_task(bool worker_task) { worker_task_ = worker_task; }
+  void set_buffer_location(BufferLocation buffer_location) { buffer_location_ = buffer_location; }
+  void set_shadow_buffer_location(BufferLocation shadow_buffer_location) {
+    shadow_buffer_location_ = shadow_buffer_location;
+  }
+  void set_min_refresh_interval(uint32_t min_refresh_interval) { min_refresh_interval_ = min_refresh_interval; }
+#ifdef USE_SENSOR
+  void set_temperature_sensor(sensor::Sensor *temperature_sensor) { temperature_sensor_ = temperature_sensor; }
+#endif
+  
+  uint32_t get_skipped_frames() const { return skipped_frames_; }
+  uint32_t get_busy_timeouts() const { return busy_timeouts_; }
+  
+#ifdef USE_SENSOR
+  void set_render_time_sensor(sensor::Sensor *sensor) { render_time_sensor_ = sensor; }
+  void set_transfer_time_sensor(sensor::Sensor *sensor) { transfer_time_sensor_ = sensor; }
+  void set_busy_wait_time_sensor(sensor::Sensor *sensor) { busy_wait_time_sensor_ = sensor; }
+  void set_refresh_time_sensor(sensor::Sensor *sensor) { refresh_time_sensor_ = sensor; }
+  void set_busy_timeouts_sensor(sensor::Sensor *sensor) { busy_timeouts_sensor_ = sensor; }
+  void set_skipped_frames_sensor(sensor::Sensor *sensor) { skipped_frames_sensor_ = sensor; }
+#endif
 
   void setup() override;
+  void loop() override;
   void dump_config() override;
   float get_setup_priority() const override { return setup_priority::PROCESSOR; }
   void update() override;
+  
+  // True while a frame is being written to or refreshed on the panel
+  bool is_refreshing() const;
+  
+  // Times the draw paths, a full-plane SPI push and each refresh mode on the
+  // device and logs the results. Blocks the main loop until done.
+  void run_benchmark(uint32_t iterations, uint32_t refreshes, display::BaseFont *font = nullptr);
 
-  display::DisplayType get_display_type() override { return display::DisplayType::DISPLAY_TYPE_BINARY; }
+  display::DisplayType get_display_type() override {
+    return this->grayscale_ ? display::DisplayType::DISPLAY_TYPE_GRAYSCALE : display::DisplayType::DISPLAY_TYPE_BINARY;
+  }
+  
+  // Byte-granular fills that skip the per-pixel path. Coordinates are in
+  // drawing orientation and respect rotation and clipping.
+  void fill(Color color) override;
+  void fill_rect(int x, int y, int width, int height, Color color = COLOR_ON);
+  void horizontal_span(int x, int y, int width, Color color = COLOR_ON);
+  // Blit a 1-bpp bitmap (MSB-first rows, each row padded to a whole byte).
+  // Rotation is applied once per span, 90/270 go through an 8x8 transpose.
+  // With transparent, cleared bits leave the buffer untouched, otherwise they
+  // are drawn in the opposite color.
+  void draw_bitmap(int x, int y, int width, int height, const uint8_t *bitmap, Color color = COLOR_ON,
+                   bool transparent = true);
 
  protected:
   void draw_absolute_pixel_internal(int x, int y, Color color) override;
-  int get_height_internal() override { return 296; }
-  int get_width_internal() override { return 128; }
+  void mark_dirty_(int x0, int y0, int x1, int y1);
+  size_t buffer_bytes_() const;
+  int get_height_internal() override { return PANEL.height; }
+  int get_width_internal() override { return PANEL.width; }
 
+  // Steps of the non-blocking frame pipeline driven from loop()
+  enum FrameState : uint8_t {
+    FRAME_STATE_IDLE = 0,
+    FRAME_STATE_WAIT_IDLE,  // wait for a delay and BUSY LOW, then go to next_state_
+    FRAME_STATE_RESET_LOW,
+    FRAME_STATE_INIT_SEQUENCE,
+    FRAME_STATE_WRITE_RAM,
+    FRAME_STATE_TRANSFER,
+    FRAME_STATE_REFRESH,
+    FRAME_STATE_REFRESH_WAIT,
+    FRAME_STATE_REFERENCE,
+  };
+  
   void init_display_();
   void hw_reset_();
-  void wait_until_idle_();
-  void command_(uint8_t cmd);
-  void data_(uint8_t data);
-  void send_data_(const uint8_t *data, size_t len);
+  void verbose_reset_();
+  void pin_swap_test_();
+  void wait_idle_then_(FrameState next, uint32_t min_delay_ms);
+  bool wait_idle_done_();
+  bool refresh_done_();
+  uint32_t refresh_timeout_() const;
+  void learn_refresh_(uint8_t mode, uint32_t elapsed);
+  uint8_t temperature_band_() const;
+  bool run_state_();
+  bool refresh_allowed_() const;
+  static void busy_isr_(SSD1680EPaper *arg);
+  void arm_busy_();
+  // Transport over SPI (DC pin) and the BUSY/RESET pins, the only place
+  // the controller is talked to
+  using Transport::command;
+  void command(uint8_t cmd, const uint8_t *data, size_t len) override;
+  void data(const uint8_t *data, size_t len) override;
+  bool busy() override;
+  void reset(bool hold) override;
+  bool play_sequence_(const uint8_t *seq, size_t len, size_t *pos, uint32_t *delay_ms);
+  bool transfer_step_();
   void full_update_();
+  uint8_t full_update_sequence_();
+  void load_waveform_(const WaveformTable &waveform);
+  void partial_update_();
+  void set_ram_window_(const RamWindow &window);
+  void diff_frame_();
+  void split_regions_();
+  bool frame_unchanged_();
+  bool submit_frame_();
+  uint32_t benchmark_frame_();
   void display_frame_();
+  void configure_();
+  uint8_t data_entry_mode_() const;
+  void write_frame_();
+  void write_reference_();
+  void finish_frame_();
+  void publish_timings_();
+  void panel_power_(bool on);
+  void enter_low_power_();
+  bool rtc_frame_valid_() const;
+  bool worker_running_() const {
+#ifdef SSD1680_EPAPER_WORKER_TASK
+    return this->worker_handle_ != nullptr;
+#else
+    return false;
+#endif
+  }
+#ifdef SSD1680_EPAPER_WORKER_TASK
+  void handoff_frame_();
+  static void worker_loop_(void *arg);
+#endif
+  uint32_t rtc_frame_tag_() const;
 
   GPIOPin *dc_pin_{nullptr};
   GPIOPin *reset_pin_{nullptr};
   GPIOPin *busy_pin_{nullptr};
   
+  // Set from the BUSY falling-edge ISR
+  bool busy_interrupt_{false};
+  volatile bool busy_released_{false};
+  volatile uint32_t busy_release_ms_{0};
+  
   bool initialized_{false};
+  // Requested placement of buffer_ and previous_buffer_, updated in setup()
+  // to where they actually ended up
+  BufferLocation buffer_location_{BUFFER_LOCATION_AUTO};
+  BufferLocation shadow_buffer_location_{BUFFER_LOCATION_AUTO};
+  // Pin swap probe and step-by-step BUSY logging on the first update
+  bool diagnostics_{false};
+  // Keep buffer_ in panel polarity (bit set = white) instead of ESPHome's
+  // (bit set = COLOR_ON), so it can be sent without a transform
+  bool native_polarity_{false};
+  // Hardware rotation: for 180 degrees the RAM counters run backwards and the
+  // buffer stays in drawing orientation (ram_rotated_), see setup()
+  bool hardware_rotation_{false};
+  bool ram_rotated_{false};
+  
+  FrameState state_{FRAME_STATE_IDLE};
+  FrameState next_state_{FRAME_STATE_IDLE};
+  uint32_t wait_start_{0};
+  uint32_t wait_min_ms_{0};
+  uint32_t refresh_start_{0};
+  uint32_t frame_start_{0};
+  // Resume position in INIT_SEQUENCE while the pipeline re-initializes
+  size_t sequence_pos_{0};
+  // Decided when the frame starts, used by the later steps
+  bool frame_partial_{false};
+  RamWindow frame_window_{0xFF, 0x00, 0xFFFF, 0x0000};
+  // frame_window_ split into windows that skip unchanged bands of rows, each
+  // sent as its own RAM 0x24 burst before the single refresh trigger
+  RamWindow frame_regions_[MAX_FRAME_REGIONS];
+  uint8_t frame_region_count_{0};
+  
+  // Update requests that arrive while a frame is in flight (or within
+  // min_refresh_interval_ of the last one) collapse into one pending update,
+  // rendered from loop() as soon as a refresh is allowed again
+  bool update_pending_{false};
+  uint32_t coalesced_updates_{0};
+  uint32_t min_refresh_interval_{0};
+  
+  // RAM planes of the frame in flight, streamed from an internal-RAM
+  // staging buffer
+  FrameWriter writer_;
+  uint8_t *staging_{nullptr};
+  uint32_t transfer_us_{0};
+  
+  // Persistent init: skip the reset sequence while the controller is known
+  // good (controller_.ready). controller_ also tracks the LUT register and
+  // RED RAM content.
+  bool persistent_init_{false};
+  ControllerState controller_;
+  Waveform waveform_{WAVEFORM_OTP};
+  // Worker task: the frame pipeline runs in its own task on the other core and
+  // sends frame_buffer_, a copy of buffer_ taken at handoff, so the lambda can
+  // draw the next frame meanwhile. Otherwise frame_buffer_ is buffer_.
+  bool worker_task_{false};
+  uint8_t *frame_buffer_{nullptr};
+#ifdef SSD1680_EPAPER_WORKER_TASK
+  TaskHandle_t worker_handle_{nullptr};
+  // Set by the main loop at handoff, cleared by the worker once the frame is done
+  std::atomic<bool> worker_busy_{false};
+  bool worker_frame_{false};
+  bool handoff_pending_{false};
+#endif
+  
+  // Grayscale: buffer_ holds 2 bits per pixel (ink level, MSB first), split
+  // into the 0x24 (low bit) and 0x26 (high bit) planes for LUT_GRAY4
+  bool grayscale_{false};
+  
+  // Waveform cache: reuse the OTP waveform a full refresh loaded, for the
+  // temperature band / time it was loaded for
+  bool waveform_cache_{false};
+  uint8_t lut_band_{0};
+  uint32_t lut_loaded_ms_{0};
+  
+  // Low power: controller deep sleep after each frame, optionally with the
+  // panel supply (GPIO7) cut, and the last frame kept in RTC memory
+  bool low_power_{false};
+  bool cut_panel_power_{false};
+  bool panel_powered_{false};
+  
+  bool red_ram_write_once_{false};
+  
+  
+  RefreshMode refresh_mode_{REFRESH_MODE_FULL};
+  uint32_t full_update_every_{30};
+  uint32_t at_update_{0};
+  
+  // Dirty tracking: bounding box of bytes touched since the last frame, and a
+  // shadow copy of the frame that RAM 0x24 currently holds
+  bool dirty_tracking_{false};
+  bool bw_ram_valid_{false};
+  uint8_t *previous_buffer_{nullptr};
+  RamWindow dirty_{0xFF, 0x00, 0xFFFF, 0x0000};
+  
+  // Result of diff_frame_(), computed once per rendered frame: changed bytes
+  // per row, their bounding box and count
+  RowSpan *diff_rows_{nullptr};
+  RamWindow diff_window_{0xFF, 0x00, 0xFFFF, 0x0000};
+  uint32_t diff_bytes_{0};
+  
+  // Skip refreshes when the rendered frame matches what is on the panel.
+  // The hash of the frame in flight only becomes last_frame_hash_ once its
+  // refresh completed without a BUSY timeout.
+  bool skip_unchanged_{false};
+  bool last_frame_valid_{false};
+  uint32_t last_frame_hash_{0};
+  uint32_t frame_hash_{0};
+  bool frame_refreshed_{false};
+  uint32_t skipped_frames_{0};
+  
+  // Per-frame timings, published when the frame completes
+  uint32_t render_us_{0};
+  uint32_t frame_transfer_us_{0};
+  uint32_t busy_wait_ms_{0};
+  uint32_t refresh_ms_{0};
+  uint32_t busy_timeouts_{0};
+  
+  // Adaptive refresh timeout: learned refresh durations per refresh mode
+  // (full, partial) and temperature band, 0 = nothing learned yet
+  bool adaptive_timeout_{false};
+  static const uint8_t TEMP_BANDS = 4;
+  float temperature_{NAN};
+  uint16_t learned_refresh_ms_[2][TEMP_BANDS]{};
+  bool busy_unreliable_[2]{false, false};
+#ifdef USE_SENSOR
+  sensor::Sensor *render_time_sensor_{nullptr};
+  sensor::Sensor *transfer_time_sensor_{nullptr};
+  sensor::Sensor *busy_wait_time_sensor_{nullptr};
+  sensor::Sensor *refresh_time_sensor_{nullptr};
+  sensor::Sensor *busy_timeouts_sensor_{nullptr};
+  sensor::Sensor *skipped_frames_sensor_{nullptr};
+  sensor::Sensor *temperature_sensor_{nullptr};
+#endif
+};
+
+template<typename... Ts> class BenchmarkAction : public Action<Ts...>, public Parented<SSD1680EPaper> {
+ public:
+  TEMPLATABLE_VALUE(uint32_t, iterations)
+  TEMPLATABLE_VALUE(uint32_t, refreshes)
+  void set_font(display::BaseFont *font) { this->font_ = font; }
+  
+  void play(Ts... x) override {
+    this->parent_->run_benchmark(this->iterations_.value(x...), this->refreshes_.value(x...), this->font_);
+  }
+  
+ protected:
+  display::BaseFont *font_{nullptr};
 };
 
 }  // namespace ssd1680_epaper
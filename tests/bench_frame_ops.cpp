@@ -0,0 +1,201 @@
+// Host microbenchmarks of the frame_ops hot paths. Host timings don't
+// transfer to the ESP32, use them to compare changes and against the naive
+// reference; the on-device numbers come from the ssd1680_epaper.benchmark
+// action.
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "frame_ops.h"
+
+using namespace esphome::ssd1680_epaper;
+
+namespace {
+
+// One panel of PANEL_GEOMETRIES
+struct Geometry {
+  explicit Geometry(const PanelGeometry &panel) : width(panel.width), height(panel.height) {
+    snprintf(this->name, sizeof(this->name), "%ux%u", panel.width, panel.height);
+  }
+  uint8_t row_bytes() const { return (this->width + 7) / 8; }
+  size_t frame_bytes() const { return size_t(this->row_bytes()) * this->height; }
+  
+  uint16_t width;
+  uint16_t height;
+  char name[12];
+};
+
+// Transport that only counts bytes, so the timing is the packing and not the
+// recording
+class NullTransport : public Transport {
+ public:
+  void command(uint8_t cmd, const uint8_t *data, size_t len) override {
+    (void) cmd;
+    (void) data;
+    this->bytes += 1 + len;
+  }
+  void data(const uint8_t *data, size_t len) override {
+    (void) data;
+    this->bytes += len;
+  }
+  bool busy() override { return false; }
+  void reset(bool hold) override { (void) hold; }
+  
+  size_t bytes{0};
+};
+
+volatile uint32_t sink;
+
+// diff_rows() must beat the byte-wise diff by these factors, a smaller
+// speedup fails the run. Unchanged rows are what the word compare is for;
+// inside changed words it falls back to bytes, so there it only must not lose.
+const double MIN_UNCHANGED_SPEEDUP = 2.0;
+const double MIN_BANDS_SPEEDUP = 1.0;
+int failures = 0;
+
+// Runs fn in five rounds of about 20 ms, prints the time per call of the
+// fastest round and returns it in ns. The fastest round is the one least
+// disturbed by other load on the host.
+template<typename F> double bench(const char *geometry, const char *name, size_t bytes, F fn) {
+  using clock = std::chrono::steady_clock;
+  double ns = 0;
+  for (int round = 0; round < 5; round++) {
+    uint32_t iterations = 0;
+    const auto start = clock::now();
+    auto elapsed = clock::duration::zero();
+    do {
+      for (int i = 0; i < 16; i++)
+        fn();
+      iterations += 16;
+      elapsed = clock::now() - start;
+    } while (elapsed < std::chrono::milliseconds(20));
+    const double round_ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    if (round == 0 || round_ns < ns)
+      ns = round_ns;
+  }
+  printf("%-7s %-34s %10.0f ns  %8.0f MB/s\n", geometry, name, ns, bytes / ns * 1e3);
+  return ns;
+}
+
+void check_speedup(const char *geometry, const char *name, double ns, double naive_ns, double min_speedup) {
+  if (naive_ns >= ns * min_speedup)
+    return;
+  printf("FAIL %s: %s only %.2fx faster than the naive diff, need %.1fx\n", geometry, name, naive_ns / ns,
+         min_speedup);
+  failures++;
+}
+
+// Byte-by-byte reference for diff_rows()
+uint32_t naive_diff(const uint8_t *cur, const uint8_t *prev, uint8_t row_bytes, uint16_t height, RowSpan *rows) {
+  uint32_t count = 0;
+  for (uint16_t y = 0; y < height; y++) {
+    rows[y] = {0xFF, 0x00};
+    for (uint8_t x = 0; x < row_bytes; x++) {
+      if (cur[y * row_bytes + x] == prev[y * row_bytes + x])
+        continue;
+      if (x < rows[y].x_start)
+        rows[y].x_start = x;
+      rows[y].x_end = x;
+      count++;
+    }
+  }
+  return count;
+}
+
+void bench_geometry(const Geometry &geometry) {
+  const uint8_t row_bytes = geometry.row_bytes();
+  const uint16_t height = geometry.height;
+  const size_t frame_bytes = geometry.frame_bytes();
+  const RamWindow full = {0, uint8_t(row_bytes - 1), 0, uint16_t(height - 1)};
+  std::mt19937 rng(1680);
+  
+  std::vector<uint32_t> cur_words(frame_bytes / 4), prev_words(frame_bytes / 4);
+  uint8_t *cur = reinterpret_cast<uint8_t *>(cur_words.data());
+  uint8_t *prev = reinterpret_cast<uint8_t *>(prev_words.data());
+  std::vector<uint8_t> gray(frame_bytes * 2), out(frame_bytes), high(frame_bytes);
+  std::vector<RowSpan> rows(height);
+  for (size_t i = 0; i < frame_bytes; i++)
+    prev[i] = rng();
+  for (uint8_t &b : gray)
+    b = rng();
+  RamWindow changed;
+  
+  // Redrawn but unchanged, e.g. a clock face between minutes
+  memcpy(cur, prev, frame_bytes);
+  double ns = bench(geometry.name, "diff_rows, unchanged", frame_bytes,
+                    [&] { sink = diff_rows(cur, prev, row_bytes, height, full, rows.data(), &changed); });
+  double naive_ns = bench(geometry.name, "naive byte diff, unchanged", frame_bytes,
+                          [&] { sink = naive_diff(cur, prev, row_bytes, height, rows.data()); });
+  check_speedup(geometry.name, "diff_rows, unchanged", ns, naive_ns, MIN_UNCHANGED_SPEEDUP);
+  
+  // A clock face: a few lines of text changed
+  for (uint16_t y = 40; y < 72; y++) {
+    for (uint8_t x = 2; x < row_bytes - 2; x++)
+      cur[y * row_bytes + x] = ~prev[y * row_bytes + x];
+  }
+  for (uint16_t y = 200; y < 216; y++)
+    cur[y * row_bytes + 4] = ~prev[y * row_bytes + 4];
+  ns = bench(geometry.name, "diff_rows, two bands changed", frame_bytes,
+             [&] { sink = diff_rows(cur, prev, row_bytes, height, full, rows.data(), &changed); });
+  naive_ns = bench(geometry.name, "naive byte diff, two bands changed", frame_bytes,
+                   [&] { sink = naive_diff(cur, prev, row_bytes, height, rows.data()); });
+  check_speedup(geometry.name, "diff_rows, two bands changed", ns, naive_ns, MIN_BANDS_SPEEDUP);
+  RamWindow regions[MAX_FRAME_REGIONS];
+  bench(geometry.name, "split_regions, two bands", frame_bytes,
+        [&] { sink = split_regions(rows.data(), changed, regions); });
+  
+  // Every byte changed, the worst case for the byte-wise fallback
+  for (size_t i = 0; i < frame_bytes; i++)
+    cur[i] = ~prev[i];
+  bench(geometry.name, "diff_rows, all changed", frame_bytes,
+        [&] { sink = diff_rows(cur, prev, row_bytes, height, full, rows.data(), &changed); });
+  bench(geometry.name, "split_regions, all changed", frame_bytes,
+        [&] { sink = split_regions(rows.data(), changed, regions); });
+  
+  bench(geometry.name, "pack_plane_row, frame", frame_bytes, [&] {
+    for (uint16_t y = 0; y < height; y++)
+      pack_plane_row(out.data() + y * row_bytes, cur + y * row_bytes, row_bytes, 0xFF, false);
+    sink = out[0];
+  });
+  bench(geometry.name, "pack_plane_row reversed, frame", frame_bytes, [&] {
+    for (uint16_t y = 0; y < height; y++)
+      pack_plane_row(out.data() + y * row_bytes, cur + y * row_bytes, row_bytes, 0xFF, true);
+    sink = out[0];
+  });
+  bench(geometry.name, "pack_gray_row, both planes", frame_bytes * 2, [&] {
+    for (uint16_t y = 0; y < height; y++)
+      pack_gray_row(out.data() + y * row_bytes, high.data() + y * row_bytes, gray.data() + y * row_bytes * 2,
+                    row_bytes, false);
+    sink = out[0] ^ high[0];
+  });
+  
+  // Window setup plus the row-by-row stream of a full plane, as the
+  // transfer does it
+  NullTransport transport;
+  bench(geometry.name, "set_ram_window + stream frame", frame_bytes, [&] {
+    set_ram_window(transport, full, row_bytes, height, false);
+    transport.command(0x24, nullptr, 0);
+    for (uint16_t y = 0; y < height; y++) {
+      pack_plane_row(out.data(), cur + y * row_bytes, row_bytes, 0xFF, false);
+      transport.data(out.data(), row_bytes);
+    }
+    sink = transport.bytes;
+  });
+}
+
+}  // namespace
+
+int main() {
+  for (const PanelGeometry &panel : PANEL_GEOMETRIES)
+    bench_geometry(Geometry(panel));
+  
+  // One 8x8 block of draw_bitmap() with 90/270 degree rotation
+  uint8_t in[8] = {0x81, 0x42, 0x24, 0x18, 0x18, 0x24, 0x42, 0x81}, out[8];
+  bench("-", "transpose8, 8x8 block", 8, [&] {
+    transpose8(in, out);
+    in[0] = out[7];
+    sink = out[0];
+  });
+  return failures == 0 ? 0 : 1;
+}
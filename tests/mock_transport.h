@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "frame_ops.h"
+
+namespace esphome {
+namespace ssd1680_epaper {
+
+// Transport that records every call and simulates the controller's B/W and
+// RED RAM: the window (0x44/0x45), address counters (0x4E/0x4F), data entry
+// mode (0x11) and the RAM writes (0x24/0x26) that data() continues. BUSY
+// follows busy_polls/busy_stuck, a hardware reset restores the register
+// defaults and keeps the RAM.
+class RecordingTransport : public Transport {
+ public:
+  struct Call {
+    enum Kind { COMMAND, DATA, BUSY, RESET } kind;
+    uint8_t cmd;
+    std::vector<uint8_t> bytes;
+  };
+  
+  RecordingTransport(uint8_t row_bytes, uint16_t height) : row_bytes_(row_bytes), height_(height) {
+    this->bw_ram.resize(size_t(row_bytes) * height);
+    this->red_ram.resize(size_t(row_bytes) * height);
+  }
+  
+  using Transport::command;
+  void command(uint8_t cmd, const uint8_t *data, size_t len) override {
+    this->calls.push_back({Call::COMMAND, cmd, std::vector<uint8_t>(data, data + len)});
+    this->command_bytes += 1 + len;
+    this->last_command_ = cmd;
+    switch (cmd) {
+      case 0x11:
+        this->entry_mode_ = len > 0 ? data[0] : 0x03;
+        break;
+      case 0x44:
+        this->x_start_ = data[0];
+        this->x_end_ = data[1];
+        break;
+      case 0x45:
+        this->y_start_ = data[0] | data[1] << 8;
+        this->y_end_ = data[2] | data[3] << 8;
+        break;
+      case 0x4E:
+        this->x_ = data[0];
+        break;
+      case 0x4F:
+        this->y_ = data[0] | data[1] << 8;
+        break;
+      case 0x24:
+      case 0x26:
+        this->write_ram_(data, len);
+        break;
+    }
+  }
+  
+  void data(const uint8_t *data, size_t len) override {
+    this->calls.push_back({Call::DATA, this->last_command_, std::vector<uint8_t>(data, data + len)});
+    this->data_bytes += len;
+    if (this->last_command_ == 0x24 || this->last_command_ == 0x26)
+      this->write_ram_(data, len);
+  }
+  
+  bool busy() override {
+    this->calls.push_back({Call::BUSY, 0, {}});
+    if (this->busy_stuck)
+      return true;
+    if (this->busy_polls == 0)
+      return false;
+    this->busy_polls--;
+    return true;
+  }
+  
+  void reset(bool hold) override {
+    this->calls.push_back({Call::RESET, uint8_t(hold), {}});
+    this->reset_held = hold;
+    if (hold) {
+      this->entry_mode_ = 0x03;
+      this->x_start_ = this->x_ = 0;
+      this->x_end_ = this->row_bytes_ - 1;
+      this->y_start_ = this->y_ = 0;
+      this->y_end_ = this->height_ - 1;
+    }
+  }
+  
+  // Commands of kind cmd recorded so far
+  size_t count(uint8_t cmd) const {
+    size_t n = 0;
+    for (const Call &call : this->calls) {
+      if (call.kind == Call::COMMAND && call.cmd == cmd)
+        n++;
+    }
+    return n;
+  }
+  
+  void clear_calls() {
+    this->calls.clear();
+    this->command_bytes = 0;
+    this->data_bytes = 0;
+  }
+  
+  std::vector<Call> calls;
+  size_t command_bytes{0};
+  size_t data_bytes{0};
+  // Indexed y * row_bytes + x in RAM coordinates
+  std::vector<uint8_t> bw_ram;
+  std::vector<uint8_t> red_ram;
+  // Bytes written outside the RAM, or with the counters past the window
+  size_t out_of_range{0};
+  // busy() reports BUSY for the next busy_polls calls, or forever
+  uint32_t busy_polls{0};
+  bool busy_stuck{false};
+  bool reset_held{false};
+  
+ protected:
+  void write_ram_(const uint8_t *data, size_t len) {
+    std::vector<uint8_t> &ram = this->last_command_ == 0x26 ? this->red_ram : this->bw_ram;
+    const bool x_inc = this->entry_mode_ & 0x01;
+    const bool y_inc = this->entry_mode_ & 0x02;
+    for (size_t i = 0; i < len; i++) {
+      if (this->x_ >= this->row_bytes_ || this->y_ >= this->height_) {
+        this->out_of_range++;
+      } else {
+        ram[size_t(this->y_) * this->row_bytes_ + this->x_] = data[i];
+      }
+      // X runs from x_start to x_end, then wraps and Y moves one line
+      if (this->x_ == this->x_end_) {
+        this->x_ = this->x_start_;
+        if (this->y_ == this->y_end_) {
+          this->y_ = this->y_start_;
+        } else {
+          this->y_ += y_inc ? 1 : -1;
+        }
+      } else {
+        this->x_ += x_inc ? 1 : -1;
+      }
+    }
+  }
+  
+  uint8_t row_bytes_;
+  uint16_t height_;
+  uint8_t last_command_{0};
+  uint8_t entry_mode_{0x03};
+  uint8_t x_start_{0};
+  uint8_t x_end_{0};
+  uint16_t y_start_{0};
+  uint16_t y_end_{0};
+  uint8_t x_{0};
+  uint16_t y_{0};
+};
+
+}  // namespace ssd1680_epaper
+}  // namespace esphome
@@ -0,0 +1,779 @@
+// Host-side correctness tests for frame_ops. Each check compares the
+// optimized code against a naive reference, on every panel geometry.
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "frame_ops.h"
+#include "mock_transport.h"
+
+using namespace esphome::ssd1680_epaper;
+
+namespace {
+
+// One panel of PANEL_GEOMETRIES
+struct Geometry {
+  explicit Geometry(const PanelGeometry &panel) : width(panel.width), height(panel.height) {
+    snprintf(this->name, sizeof(this->name), "%ux%u", panel.width, panel.height);
+  }
+  uint8_t row_bytes() const { return (this->width + 7) / 8; }
+  size_t frame_bytes() const { return size_t(this->row_bytes()) * this->height; }
+  
+  uint16_t width;
+  uint16_t height;
+  char name[12];
+};
+
+int failures = 0;
+int checks = 0;
+
+#define CHECK(cond, ...) \
+  do { \
+    checks++; \
+    if (!(cond)) { \
+      if (failures++ < 20) { \
+        printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+      } \
+    } \
+  } while (0)
+
+std::mt19937 rng(1680);
+
+uint32_t random_below(uint32_t n) { return std::uniform_int_distribution<uint32_t>(0, n - 1)(rng); }
+
+// Word-aligned frame buffer, as the heap buffers of the component
+struct Frame {
+  explicit Frame(size_t bytes) : words((bytes + 3) / 4) {}
+  uint8_t *data() { return reinterpret_cast<uint8_t *>(this->words.data()); }
+  std::vector<uint32_t> words;
+};
+
+uint8_t naive_reverse(uint8_t b) {
+  uint8_t r = 0;
+  for (int i = 0; i < 8; i++) {
+    if (b & (1 << i))
+      r |= 0x80 >> i;
+  }
+  return r;
+}
+
+// Plane bytes of 8 pixels in hi:lo, one bit at a time: high plane << 8 | low
+// plane, as gray_planes()
+uint16_t naive_gray_planes(uint8_t hi, uint8_t lo) {
+  const uint16_t pixels = hi << 8 | lo;
+  uint16_t planes = 0;
+  for (int p = 0; p < 8; p++) {
+    if (pixels & (1 << (14 - 2 * p)))
+      planes |= 0x80 >> p;
+    if (pixels & (2 << (14 - 2 * p)))
+      planes |= 0x8000 >> p;
+  }
+  return planes;
+}
+
+// Changes between random frames, only inside the dirty rows like the
+// drawing code guarantees. Returns the dirty window.
+RamWindow mutate(const Geometry &geometry, uint8_t *cur, const uint8_t *prev) {
+  const uint8_t row_bytes = geometry.row_bytes();
+  memcpy(cur, prev, geometry.frame_bytes());
+  uint16_t y0 = random_below(geometry.height);
+  uint16_t y1 = y0 + random_below(geometry.height - y0);
+  const RamWindow dirty = {0, uint8_t(row_bytes - 1), y0, y1};
+  switch (random_below(4)) {
+    case 0:
+      // Drawn over but unchanged
+      break;
+    case 1:
+      // A few scattered bytes
+      for (uint32_t n = random_below(8) + 1; n > 0; n--) {
+        uint32_t y = y0 + random_below(y1 - y0 + 1);
+        cur[y * row_bytes + random_below(row_bytes)] ^= 1 << random_below(8);
+      }
+      break;
+    case 2:
+      // A few bands of rows, e.g. text lines
+      for (uint32_t n = random_below(4) + 1; n > 0; n--) {
+        uint32_t y = y0 + random_below(y1 - y0 + 1);
+        uint32_t rows = std::min<uint32_t>(random_below(16) + 1, y1 - y + 1);
+        uint32_t x = random_below(row_bytes);
+        uint32_t w = random_below(row_bytes - x) + 1;
+        for (uint32_t r = 0; r < rows; r++) {
+          for (uint32_t i = 0; i < w; i++)
+            cur[(y + r) * row_bytes + x + i] = ~cur[(y + r) * row_bytes + x + i];
+        }
+      }
+      break;
+    default:
+      // Everything inside the dirty rows
+      for (uint32_t i = uint32_t(y0) * row_bytes; i < (uint32_t(y1) + 1) * row_bytes; i++)
+        cur[i] = ~cur[i];
+      break;
+  }
+  return dirty;
+}
+
+void put_bit(uint8_t *buffer, uint8_t row_bytes, int x, int y, bool set) {
+  if (set) {
+    buffer[y * row_bytes + x / 8] |= 0x80 >> (x % 8);
+  } else {
+    buffer[y * row_bytes + x / 8] &= ~(0x80 >> (x % 8));
+  }
+}
+
+// DisplayBuffer::draw_pixel_at() rotation, one pixel at a time
+void to_panel(const Geometry &geometry, int rotation, int x, int y, int *px, int *py) {
+  switch (rotation) {
+    case 90:
+      *px = geometry.width - 1 - y;
+      *py = x;
+      break;
+    case 180:
+      *px = geometry.width - 1 - x;
+      *py = geometry.height - 1 - y;
+      break;
+    case 270:
+      *px = y;
+      *py = geometry.height - 1 - x;
+      break;
+    default:
+      *px = x;
+      *py = y;
+      break;
+  }
+}
+
+void random_fill(std::vector<uint8_t> &buffer) {
+  for (uint8_t &b : buffer)
+    b = random_below(256);
+}
+
+void test_pixels(const Geometry &geometry) {
+  const uint8_t row_bytes = geometry.row_bytes();
+  const int width = geometry.width;
+  const int height = geometry.height;
+  std::vector<uint8_t> buffer(geometry.frame_bytes()), expected(geometry.frame_bytes());
+  
+  for (int trial = 0; trial < 2000; trial++) {
+    random_fill(buffer);
+    expected = buffer;
+    const int x = random_below(width);
+    const int y = random_below(height);
+    const bool set = trial & 1;
+    set_pixel(buffer.data(), row_bytes, x, y, set);
+    put_bit(expected.data(), row_bytes, x, y, set);
+    CHECK(buffer == expected, "%s: set_pixel(%d, %d, %d)", geometry.name, x, y, set);
+  
+    std::vector<uint8_t> gray(geometry.frame_bytes() * 2);
+    random_fill(gray);
+    std::vector<uint8_t> gray_expected = gray;
+    const uint8_t level = random_below(4);
+    set_gray_pixel(gray.data(), row_bytes * 2, x, y, level);
+    for (int bit = 0; bit < 2; bit++)
+      put_bit(gray_expected.data(), row_bytes * 2, 2 * x + bit, y, level & (2 >> bit));
+    CHECK(gray == gray_expected, "%s: set_gray_pixel(%d, %d, %u)", geometry.name, x, y, level);
+  }
+  
+  // Inclusive panel rectangles: only the rectangle changes, padding bits of
+  // the last byte included
+  for (int trial = 0; trial < 2000; trial++) {
+    random_fill(buffer);
+    expected = buffer;
+    int x0 = random_below(width), x1 = random_below(width);
+    int y0 = random_below(height), y1 = random_below(height);
+    if (x0 > x1)
+      std::swap(x0, x1);
+    if (y0 > y1)
+      std::swap(y0, y1);
+    const bool set = trial & 1;
+    fill_rect_absolute(buffer.data(), row_bytes, x0, y0, x1, y1, set);
+    for (int py = y0; py <= y1; py++) {
+      for (int px = x0; px <= x1; px++)
+        put_bit(expected.data(), row_bytes, px, py, set);
+    }
+    CHECK(buffer == expected, "%s: fill_rect_absolute(%d, %d, %d, %d, %d)", geometry.name, x0, y0, x1, y1, set);
+  }
+  
+  for (int trial = 0; trial < 4000; trial++) {
+    random_fill(buffer);
+    expected = buffer;
+    const int x = int(random_below(row_bytes * 8 + 7)) - 7;
+    const int y = random_below(height);
+    const uint8_t bits = random_below(256);
+    // Only bits that land inside the row may be masked in
+    uint8_t mask = random_below(256);
+    for (int k = 0; k < 8; k++) {
+      if (x + k < 0 || x + k >= row_bytes * 8)
+        mask &= ~(0x80 >> k);
+    }
+    const bool set = trial & 1;
+    const bool transparent = trial & 2;
+    write_bits(buffer.data(), row_bytes, x, y, bits, mask, set, transparent);
+    for (int k = 0; k < 8; k++) {
+      const bool on = bits & (0x80 >> k);
+      if ((mask & (0x80 >> k)) && (on || !transparent))
+        put_bit(expected.data(), row_bytes, x + k, y, on ? set : !set);
+    }
+    CHECK(buffer == expected, "%s: write_bits(%d, %d, %02X, %02X, %d, %d)", geometry.name, x, y, bits, mask, set,
+          transparent);
+  }
+  
+  for (int rotation : {0, 90, 180, 270}) {
+    // Drawing coordinates swap the panel axes at 90/270
+    const bool swapped = rotation == 90 || rotation == 270;
+    const int draw_width = swapped ? height : width;
+    const int draw_height = swapped ? width : height;
+  
+    for (int trial = 0; trial < 2000; trial++) {
+      const int x0 = random_below(draw_width);
+      const int y0 = random_below(draw_height);
+      const int x1 = x0 + 1 + random_below(draw_width - x0);
+      const int y1 = y0 + 1 + random_below(draw_height - y0);
+      int ax0, ay0, ax1, ay1;
+      to_absolute_rect(rotation, width, height, x0, y0, x1, y1, &ax0, &ay0, &ax1, &ay1);
+      // The mapped corners span the mapped rectangle
+      int cx0, cy0, cx1, cy1;
+      to_panel(geometry, rotation, x0, y0, &cx0, &cy0);
+      to_panel(geometry, rotation, x1 - 1, y1 - 1, &cx1, &cy1);
+      CHECK(ax0 == std::min(cx0, cx1) && ax1 == std::max(cx0, cx1) && ay0 == std::min(cy0, cy1) &&
+                ay1 == std::max(cy0, cy1),
+            "%s: to_absolute_rect(%d, %d, %d, %d) at %d: %d,%d-%d,%d", geometry.name, x0, y0, x1, y1, rotation, ax0,
+            ay0, ax1, ay1);
+    }
+  
+    std::vector<uint8_t> bitmap;
+    for (int trial = 0; trial < 1500; trial++) {
+      // Mostly small glyphs, some as large as the panel, always fully visible
+      const int limit = trial % 8 == 0 ? 1 << 16 : 40;
+      const int bitmap_width = random_below(std::min(draw_width, limit)) + 1;
+      const int bitmap_height = random_below(std::min(draw_height, limit)) + 1;
+      const int x = random_below(draw_width - bitmap_width + 1);
+      const int y = random_below(draw_height - bitmap_height + 1);
+      const int stride = (bitmap_width + 7) / 8;
+      bitmap.resize(stride * bitmap_height);
+      random_fill(bitmap);
+      const bool set = trial & 1;
+      const bool transparent = trial & 2;
+  
+      random_fill(buffer);
+      expected = buffer;
+      blit_bitmap(buffer.data(), row_bytes, width, height, rotation, x, y, bitmap_width, bitmap_height,
+                  bitmap.data(), set, transparent);
+      for (int r = 0; r < bitmap_height; r++) {
+        for (int c = 0; c < bitmap_width; c++) {
+          const bool on = bitmap[r * stride + c / 8] & (0x80 >> (c % 8));
+          if (!on && transparent)
+            continue;
+          int px, py;
+          to_panel(geometry, rotation, x + c, y + r, &px, &py);
+          put_bit(expected.data(), row_bytes, px, py, on ? set : !set);
+        }
+      }
+      CHECK(buffer == expected, "%s: blit_bitmap %dx%d at %d,%d, rotation %d, set %d, transparent %d",
+            geometry.name, bitmap_width, bitmap_height, x, y, rotation, set, transparent);
+    }
+  }
+}
+
+void test_diff_rows(const Geometry &geometry) {
+  const uint8_t row_bytes = geometry.row_bytes();
+  Frame cur(geometry.frame_bytes()), prev(geometry.frame_bytes());
+  std::vector<RowSpan> rows(geometry.height);
+  for (size_t i = 0; i < geometry.frame_bytes(); i++)
+    prev.data()[i] = random_below(256);
+  
+  for (int trial = 0; trial < 500; trial++) {
+    const RamWindow dirty = mutate(geometry, cur.data(), prev.data());
+    RamWindow changed;
+    uint32_t count = diff_rows(cur.data(), prev.data(), row_bytes, geometry.height, dirty, rows.data(), &changed);
+  
+    RamWindow expected = EMPTY_WINDOW;
+    uint32_t expected_count = 0;
+    for (uint16_t y = 0; y < geometry.height; y++) {
+      RowSpan span = {0xFF, 0x00};
+      for (uint8_t x = 0; x < row_bytes; x++) {
+        if (cur.data()[y * row_bytes + x] == prev.data()[y * row_bytes + x])
+          continue;
+        span.x_start = std::min(span.x_start, x);
+        span.x_end = std::max(span.x_end, x);
+        expected.x_start = std::min(expected.x_start, x);
+        expected.x_end = std::max(expected.x_end, x);
+        expected.y_start = std::min(expected.y_start, y);
+        expected.y_end = y;
+        expected_count++;
+      }
+      CHECK(rows[y].x_start == span.x_start && rows[y].x_end == span.x_end, "%s row %u: %u-%u, expected %u-%u",
+            geometry.name, y, rows[y].x_start, rows[y].x_end, span.x_start, span.x_end);
+    }
+    CHECK(count == expected_count, "%s: %u changed bytes, expected %u", geometry.name, count, expected_count);
+    CHECK(memcmp(&changed, &expected, sizeof(RamWindow)) == 0, "%s: window %u-%u x %u-%u, expected %u-%u x %u-%u",
+          geometry.name, changed.x_start, changed.x_end, changed.y_start, changed.y_end, expected.x_start,
+          expected.x_end, expected.y_start, expected.y_end);
+    memcpy(prev.data(), cur.data(), geometry.frame_bytes());
+  }
+  
+  // Nothing drawn: nothing compared
+  RamWindow changed;
+  cur.data()[0] ^= 0xFF;
+  uint32_t count = diff_rows(cur.data(), prev.data(), row_bytes, geometry.height, EMPTY_WINDOW, rows.data(), &changed);
+  CHECK(count == 0 && changed.is_empty() && rows[0].is_empty(), "%s: empty dirty window", geometry.name);
+}
+
+void test_split_regions(const Geometry &geometry) {
+  const uint8_t row_bytes = geometry.row_bytes();
+  Frame cur(geometry.frame_bytes()), prev(geometry.frame_bytes());
+  std::vector<RowSpan> rows(geometry.height);
+  memset(prev.data(), 0, geometry.frame_bytes());
+  
+  for (int trial = 0; trial < 500; trial++) {
+    const RamWindow dirty = mutate(geometry, cur.data(), prev.data());
+    RamWindow changed;
+    diff_rows(cur.data(), prev.data(), row_bytes, geometry.height, dirty, rows.data(), &changed);
+    RamWindow regions[MAX_FRAME_REGIONS];
+    uint8_t count = split_regions(rows.data(), changed, regions);
+  
+    if (changed.is_empty()) {
+      CHECK(count == 0, "%s: %u regions for an unchanged frame", geometry.name, count);
+      continue;
+    }
+    CHECK(count >= 1 && count <= MAX_FRAME_REGIONS, "%s: %u regions", geometry.name, count);
+    // Sorted, disjoint, inside the changed window and never more bytes than it
+    uint32_t bytes = 0;
+    for (uint8_t i = 0; i < count; i++) {
+      const RamWindow &r = regions[i];
+      CHECK(r.x_start >= changed.x_start && r.x_end <= changed.x_end && r.y_start >= changed.y_start &&
+                r.y_end <= changed.y_end && r.x_start <= r.x_end && r.y_start <= r.y_end,
+            "%s: region %u outside the changed window", geometry.name, i);
+      if (i > 0)
+        CHECK(r.y_start > regions[i - 1].y_end, "%s: regions %u and %u overlap", geometry.name, i - 1, i);
+      bytes += window_bytes(r);
+    }
+    CHECK(bytes <= window_bytes(changed), "%s: %u bytes in regions, window is %u", geometry.name, bytes,
+          window_bytes(changed));
+    // Every changed byte is covered by a region
+    for (uint16_t y = 0; y < geometry.height; y++) {
+      if (rows[y].is_empty())
+        continue;
+      bool covered = false;
+      for (uint8_t i = 0; i < count; i++) {
+        const RamWindow &r = regions[i];
+        covered |= y >= r.y_start && y <= r.y_end && rows[y].x_start >= r.x_start && rows[y].x_end <= r.x_end;
+      }
+      CHECK(covered, "%s: row %u not covered", geometry.name, y);
+    }
+    memcpy(prev.data(), cur.data(), geometry.frame_bytes());
+  }
+}
+
+// Streams window through the mock the way transfer_step_() does
+// Staging buffer size of the component
+const size_t STAGING_BYTES = 1024;
+
+// Expected RAM content for frame: inverted unless native and, when rotated,
+// mirrored on both axes with the bits of each byte reversed
+std::vector<uint8_t> expected_ram(const Geometry &geometry, const uint8_t *frame, bool rotated, bool native = false) {
+  const uint8_t row_bytes = geometry.row_bytes();
+  std::vector<uint8_t> ram(geometry.frame_bytes());
+  for (uint16_t y = 0; y < geometry.height; y++) {
+    for (uint8_t x = 0; x < row_bytes; x++) {
+      uint8_t b = frame[y * row_bytes + x] ^ (native ? 0x00 : 0xFF);
+      if (rotated) {
+        ram[(geometry.height - 1 - y) * row_bytes + (row_bytes - 1 - x)] = naive_reverse(b);
+      } else {
+        ram[y * row_bytes + x] = b;
+      }
+    }
+  }
+  return ram;
+}
+
+// Steps the writer until its queue is sent, as the TRANSFER and REFERENCE
+// states do. Returns the number of steps.
+int run_writer(FrameWriter &writer, RecordingTransport &transport) {
+  int steps = 1;
+  while (!writer.step(transport)) {
+    if (++steps > 100000) {
+      CHECK(false, "writer never finished");
+      break;
+    }
+  }
+  return steps;
+}
+
+RamWindow full_window(const Geometry &geometry) {
+  return {0, uint8_t(geometry.row_bytes() - 1), 0, uint16_t(geometry.height - 1)};
+}
+
+// Partial refresh mode: full frames, then partial ones through diff_rows()
+// and split_regions(). B/W RAM must always equal a full write of the new
+// frame, and RED RAM the frame before it until the reference is written.
+void test_frame_writes(const Geometry &geometry, bool rotated, size_t staging_bytes) {
+  const uint8_t row_bytes = geometry.row_bytes();
+  const RamWindow full = full_window(geometry);
+  Frame cur(geometry.frame_bytes()), prev(geometry.frame_bytes());
+  std::vector<RowSpan> rows(geometry.height);
+  std::vector<uint8_t> staging(staging_bytes);
+  for (size_t i = 0; i < geometry.frame_bytes(); i++)
+    prev.data()[i] = random_below(256);
+  
+  RecordingTransport transport(row_bytes, geometry.height);
+  transport.command(0x11, rotated ? 0x00 : 0x03);
+  ControllerState controller;
+  FrameWriter writer;
+  writer.set_layout(row_bytes, geometry.height, staging.data(), staging.size());
+  writer.set_format(false, rotated, false);
+  writer.set_red_ram(true, false);
+  
+  writer.write_frame(controller, prev.data(), &full, 1, false, nullptr);
+  run_writer(writer, transport);
+  CHECK(transport.bw_ram == expected_ram(geometry, prev.data(), rotated), "%s: full write%s", geometry.name,
+        rotated ? " (rotated)" : "");
+  CHECK(transport.red_ram == std::vector<uint8_t>(geometry.frame_bytes(), 0x00), "%s: RED RAM not cleared",
+        geometry.name);
+  CHECK(controller.red_ram == RED_RAM_CLEARED, "%s: RED RAM state %u after a full frame", geometry.name,
+        controller.red_ram);
+  writer.write_reference(controller);
+  run_writer(writer, transport);
+  CHECK(transport.red_ram == expected_ram(geometry, prev.data(), rotated), "%s: reference after a full frame",
+        geometry.name);
+  CHECK(controller.red_ram == RED_RAM_PREVIOUS_FRAME, "%s: RED RAM state %u after the reference", geometry.name,
+        controller.red_ram);
+  
+  for (int trial = 0; trial < 100; trial++) {
+    const RamWindow dirty = mutate(geometry, cur.data(), prev.data());
+    RamWindow changed;
+    diff_rows(cur.data(), prev.data(), row_bytes, geometry.height, dirty, rows.data(), &changed);
+    RamWindow regions[MAX_FRAME_REGIONS];
+    uint8_t count = split_regions(rows.data(), changed, regions);
+    uint32_t bytes = 0;
+    for (uint8_t i = 0; i < count; i++)
+      bytes += window_bytes(regions[i]);
+  
+    transport.clear_calls();
+    writer.write_frame(controller, cur.data(), regions, count, true, nullptr);
+    run_writer(writer, transport);
+    CHECK(transport.data_bytes == bytes && writer.bytes() == bytes, "%s: sent %zu bytes, regions hold %u",
+          geometry.name, transport.data_bytes, bytes);
+    CHECK(transport.count(0x24) == count && transport.count(0x26) == 0, "%s: %zu B/W and %zu RED writes for %u regions",
+          geometry.name, transport.count(0x24), transport.count(0x26), count);
+    CHECK(transport.bw_ram == expected_ram(geometry, cur.data(), rotated), "%s: RAM differs after trial %d%s",
+          geometry.name, trial, rotated ? " (rotated)" : "");
+    CHECK(transport.red_ram == expected_ram(geometry, prev.data(), rotated), "%s: reference overwritten in trial %d",
+          geometry.name, trial);
+  
+    writer.write_reference(controller);
+    run_writer(writer, transport);
+    CHECK(transport.red_ram == expected_ram(geometry, cur.data(), rotated), "%s: reference differs after trial %d%s",
+          geometry.name, trial, rotated ? " (rotated)" : "");
+    memcpy(prev.data(), cur.data(), geometry.frame_bytes());
+  }
+  CHECK(transport.out_of_range == 0, "%s: %zu bytes outside the RAM", geometry.name, transport.out_of_range);
+}
+
+// RED RAM policies and buffer formats of FrameWriter::write_frame()
+void test_frame_formats(const Geometry &geometry) {
+  const uint8_t row_bytes = geometry.row_bytes();
+  const RamWindow full = full_window(geometry);
+  Frame frame(geometry.frame_bytes() * 2), shown(geometry.frame_bytes());
+  for (size_t i = 0; i < geometry.frame_bytes() * 2; i++)
+    frame.data()[i] = random_below(256);
+  for (size_t i = 0; i < geometry.frame_bytes(); i++)
+    shown.data()[i] = random_below(256);
+  std::vector<uint8_t> staging(STAGING_BYTES);
+  RecordingTransport transport(row_bytes, geometry.height);
+  ControllerState controller;
+  FrameWriter writer;
+  writer.set_layout(row_bytes, geometry.height, staging.data(), staging.size());
+  
+  // Full refresh mode: no reference, and write-once clears RED RAM only when
+  // its content is unknown
+  writer.set_format(false, false, false);
+  writer.set_red_ram(false, true);
+  for (int i = 0; i < 3; i++) {
+    if (i == 2)
+      controller.red_ram = RED_RAM_UNKNOWN;
+    transport.clear_calls();
+    writer.write_frame(controller, frame.data(), &full, 1, false, nullptr);
+    run_writer(writer, transport);
+    CHECK(transport.count(0x26) == (i == 1 ? 0u : 1u), "%s: write-once frame %d sent %zu RED writes", geometry.name,
+          i, transport.count(0x26));
+    transport.clear_calls();
+    writer.write_reference(controller);
+    CHECK(run_writer(writer, transport) == 1 && transport.calls.empty(), "%s: reference written in full mode",
+          geometry.name);
+  }
+  CHECK(controller.red_ram == RED_RAM_CLEARED, "%s: RED RAM state %u in full mode", geometry.name, controller.red_ram);
+  
+  // A partial frame after the reference was lost restores the shown frame
+  // first, a partial frame with an intact reference doesn't
+  writer.set_red_ram(true, false);
+  const RamWindow band = {1, uint8_t(row_bytes - 2), 10, 20};
+  for (RedRamState state : {RED_RAM_UNKNOWN, RED_RAM_PREVIOUS_FRAME}) {
+    controller.red_ram = state;
+    transport.red_ram.assign(geometry.frame_bytes(), 0x5A);
+    transport.clear_calls();
+    writer.write_frame(controller, frame.data(), &band, 1, true, shown.data());
+    run_writer(writer, transport);
+    const bool restored = state == RED_RAM_UNKNOWN;
+    CHECK(transport.count(0x26) == (restored ? 1u : 0u), "%s: %zu RED writes with RED RAM state %u", geometry.name,
+          transport.count(0x26), state);
+    if (restored) {
+      CHECK(transport.red_ram == expected_ram(geometry, shown.data(), false), "%s: reference not restored",
+            geometry.name);
+    }
+    CHECK(controller.red_ram == RED_RAM_PREVIOUS_FRAME, "%s: RED RAM state %u after a restore", geometry.name,
+          controller.red_ram);
+  }
+  
+  // Native polarity: full-width rows go out unpacked, narrower windows are
+  // packed without the inversion
+  writer.set_format(true, false, false);
+  writer.set_red_ram(false, false);
+  transport.clear_calls();
+  writer.write_frame(controller, frame.data(), &full, 1, false, nullptr);
+  run_writer(writer, transport);
+  CHECK(transport.bw_ram == expected_ram(geometry, frame.data(), false, true), "%s: native full write",
+        geometry.name);
+  writer.write_frame(controller, shown.data(), &band, 1, false, nullptr);
+  run_writer(writer, transport);
+  std::vector<uint8_t> expected = expected_ram(geometry, frame.data(), false, true);
+  for (uint16_t y = band.y_start; y <= band.y_end; y++) {
+    for (uint8_t x = band.x_start; x <= band.x_end; x++)
+      expected[y * row_bytes + x] = shown.data()[y * row_bytes + x];
+  }
+  CHECK(transport.bw_ram == expected, "%s: native window write", geometry.name);
+  
+  // Grayscale: B/W RAM gets the low bit of every 2-bpp pixel, RED RAM the
+  // high bit, both from one pass; also with room for just one row per plane
+  std::vector<uint8_t> low(geometry.frame_bytes()), high(geometry.frame_bytes());
+  // expected_ram() inverts, the planes are sent as they are
+  for (size_t i = 0; i < geometry.frame_bytes(); i++) {
+    const uint16_t planes = naive_gray_planes(frame.data()[2 * i], frame.data()[2 * i + 1]);
+    low[i] = ~(planes & 0xFF);
+    high[i] = ~(planes >> 8);
+  }
+  for (size_t staging_bytes : {STAGING_BYTES, size_t(2 * row_bytes + 1)}) {
+    writer.set_layout(row_bytes, geometry.height, staging.data(), staging_bytes);
+    for (bool rotated : {false, true}) {
+      writer.set_format(false, rotated, true);
+      transport.command(0x11, rotated ? 0x00 : 0x03);
+      transport.bw_ram.assign(geometry.frame_bytes(), 0x5A);
+      transport.red_ram.assign(geometry.frame_bytes(), 0x5A);
+      transport.clear_calls();
+      writer.write_frame(controller, frame.data(), &full, 1, false, nullptr);
+      run_writer(writer, transport);
+      const size_t bands = (geometry.height + staging_bytes / 2 / row_bytes - 1) / (staging_bytes / 2 / row_bytes);
+      CHECK(transport.count(0x24) == bands && transport.count(0x26) == bands, "%s: %zu/%zu plane writes, %zu bands",
+            geometry.name, transport.count(0x24), transport.count(0x26), bands);
+      CHECK(writer.bytes() == 2 * geometry.frame_bytes(), "%s: %u grayscale bytes", geometry.name, writer.bytes());
+      CHECK(transport.bw_ram == expected_ram(geometry, low.data(), rotated), "%s: grayscale low plane%s",
+            geometry.name, rotated ? " (rotated)" : "");
+      CHECK(transport.red_ram == expected_ram(geometry, high.data(), rotated), "%s: grayscale high plane%s",
+            geometry.name, rotated ? " (rotated)" : "");
+      CHECK(controller.red_ram == RED_RAM_UNKNOWN, "%s: RED RAM state %u in grayscale", geometry.name,
+            controller.red_ram);
+    }
+  }
+  CHECK(transport.out_of_range == 0, "%s: %zu bytes outside the RAM", geometry.name, transport.out_of_range);
+}
+
+// Persistent init: frames skip the reset until a BUSY timeout, the next
+// frame then holds RESET like a fresh boot
+void test_persistent_init() {
+  RecordingTransport transport(16, 296);
+  ControllerState controller;
+  CHECK(controller.needs_reset(true) && controller.needs_reset(false), "fresh boot without a reset");
+  controller.ready = true;
+  // waveform_cache: the OTP waveform of the last full refresh is loaded
+  controller.lut = LUT_STATE_OTP;
+  CHECK(!controller.needs_reset(true), "persistent init resets a ready controller");
+  CHECK(controller.needs_reset(false), "no reset without persistent init");
+  
+  // The refresh of that frame never releases BUSY
+  transport.busy_stuck = true;
+  CHECK(poll_busy(transport, controller, 10000, 10000) == BUSY_WAIT_PENDING, "timeout at the limit");
+  CHECK(!controller.needs_reset(true), "reset before the timeout");
+  CHECK(poll_busy(transport, controller, 10001, 10000) == BUSY_WAIT_TIMEOUT, "no timeout");
+  transport.busy_stuck = false;
+  CHECK(controller.needs_reset(true), "a BUSY timeout doesn't force a reset");
+  CHECK(controller.lut == LUT_STATE_DEFAULT, "cached waveform kept after a BUSY timeout");
+  
+  // Next frame, as display_frame_() starts it
+  transport.command(0x11, 0x00);
+  transport.clear_calls();
+  if (controller.needs_reset(true))
+    begin_reset(transport, controller, true);
+  CHECK(transport.reset_held && transport.count(0x11) == 0 && transport.calls.size() == 1,
+        "next frame didn't hold RESET");
+  transport.reset(false);
+  controller.ready = true;
+  CHECK(!controller.needs_reset(true), "reset again after the init sequence");
+}
+
+// BUSY waits and the reset that starts a frame without persistent init
+void test_controller_state() {
+  RecordingTransport transport(16, 296);
+  ControllerState controller;
+  controller.ready = true;
+  controller.lut = LUT_STATE_OTP;
+  
+  transport.busy_polls = 3;
+  for (int i = 0; i < 3; i++)
+    CHECK(poll_busy(transport, controller, 100, 1000) == BUSY_WAIT_PENDING, "poll %d while BUSY", i);
+  CHECK(poll_busy(transport, controller, 100, 1000) == BUSY_WAIT_DONE, "poll after BUSY released");
+  CHECK(controller.ready && controller.lut == LUT_STATE_OTP, "state lost without a timeout");
+  CHECK(transport.calls.size() == 4 && transport.calls.back().kind == RecordingTransport::Call::BUSY,
+        "%zu calls for 4 polls", transport.calls.size());
+  
+  transport.busy_stuck = true;
+  CHECK(poll_busy(transport, controller, 1000, 1000) == BUSY_WAIT_PENDING, "timeout before timeout_ms");
+  CHECK(controller.ready, "not ready before the timeout");
+  CHECK(poll_busy(transport, controller, 1001, 1000) == BUSY_WAIT_TIMEOUT, "no timeout after timeout_ms");
+  CHECK(!controller.ready && controller.lut == LUT_STATE_DEFAULT, "ready %d, LUT state %u after a BUSY timeout",
+        controller.ready, controller.lut);
+  transport.busy_stuck = false;
+  
+  // A hardware reset also resets the registers, the RAM survives
+  controller.ready = true;
+  controller.lut = LUT_STATE_WAVEFORM;
+  controller.red_ram = RED_RAM_PREVIOUS_FRAME;
+  transport.command(0x11, 0x00);
+  transport.red_ram.assign(transport.red_ram.size(), 0xA5);
+  transport.clear_calls();
+  begin_reset(transport, controller, true);
+  CHECK(transport.reset_held && transport.calls.size() == 1 &&
+            transport.calls[0].kind == RecordingTransport::Call::RESET,
+        "RESET not held");
+  CHECK(!controller.ready && controller.lut == LUT_STATE_DEFAULT, "state kept across a reset");
+  CHECK(controller.red_ram == RED_RAM_PREVIOUS_FRAME && transport.red_ram[0] == 0xA5, "RED RAM lost in a reset");
+  transport.reset(false);
+  
+  // Without a RESET line only the state goes, the SW reset follows
+  controller.ready = true;
+  controller.lut = LUT_STATE_PARTIAL;
+  transport.clear_calls();
+  begin_reset(transport, controller, false);
+  CHECK(transport.calls.empty() && !controller.ready && controller.lut == LUT_STATE_DEFAULT, "SW reset start");
+}
+
+void test_set_ram_window() {
+  const Geometry geometry(PANEL_GEOMETRIES[PANEL_MODEL_2_90IN]);
+  RecordingTransport transport(geometry.row_bytes(), geometry.height);
+  const RamWindow window = {2, 5, 10, 20};
+  
+  set_ram_window(transport, window, geometry.row_bytes(), geometry.height, false);
+  const std::vector<std::pair<uint8_t, std::vector<uint8_t>>> plain = {
+      {0x44, {2, 5}}, {0x45, {10, 0, 20, 0}}, {0x4E, {2}}, {0x4F, {10, 0}}};
+  CHECK(transport.calls.size() == plain.size(), "%zu calls", transport.calls.size());
+  for (size_t i = 0; i < plain.size() && i < transport.calls.size(); i++) {
+    CHECK(transport.calls[i].cmd == plain[i].first && transport.calls[i].bytes == plain[i].second,
+          "command %zu: 0x%02X", i, transport.calls[i].cmd);
+  }
+  
+  // Rotated: 15 - x, 295 - y
+  transport.clear_calls();
+  set_ram_window(transport, window, geometry.row_bytes(), geometry.height, true);
+  const std::vector<std::pair<uint8_t, std::vector<uint8_t>>> rotated = {
+      {0x44, {13, 10}}, {0x45, {0x1D, 0x01, 0x13, 0x01}}, {0x4E, {13}}, {0x4F, {0x1D, 0x01}}};
+  CHECK(transport.calls.size() == rotated.size(), "%zu calls (rotated)", transport.calls.size());
+  for (size_t i = 0; i < rotated.size() && i < transport.calls.size(); i++) {
+    CHECK(transport.calls[i].cmd == rotated[i].first && transport.calls[i].bytes == rotated[i].second,
+          "command %zu (rotated): 0x%02X", i, transport.calls[i].cmd);
+  }
+}
+
+void test_transpose8() {
+  for (int trial = 0; trial < 20000; trial++) {
+    uint8_t in[8], out[8];
+    for (uint8_t &b : in)
+      b = trial < 64 ? 0 : random_below(256);
+    // Single bits first, then random matrices
+    if (trial < 64)
+      in[trial / 8] = 0x80 >> (trial % 8);
+    transpose8(in, out);
+    for (int k = 0; k < 8; k++) {
+      uint8_t expected = 0;
+      for (int m = 0; m < 8; m++) {
+        if (in[m] & (0x80 >> k))
+          expected |= 0x80 >> m;
+      }
+      CHECK(out[k] == expected, "trial %d row %d: %02X, expected %02X", trial, k, out[k], expected);
+    }
+  }
+}
+
+void test_bits() {
+  for (int b = 0; b < 256; b++)
+    CHECK(reverse_bits(b) == naive_reverse(b), "reverse_bits(%02X)", b);
+  
+  // Exhaustive over both bytes
+  for (int hi = 0; hi < 256; hi++) {
+    for (int lo = 0; lo < 256; lo++) {
+      CHECK(gray_planes(hi, lo) == naive_gray_planes(hi, lo), "gray_planes(%02X, %02X)", hi, lo);
+    }
+  }
+  
+  CHECK(gray_level(0, 0, 0, 0) == 0, "COLOR_OFF");
+  CHECK(gray_level(255, 255, 255, 255) == 3, "COLOR_ON");
+  // Image pixels are opaque, w = 255
+  CHECK(gray_level(0, 0, 0, 255) == 3 && gray_level(254, 254, 254, 255) == 0, "image black and white");
+  CHECK(gray_level(255, 255, 255, 0) == 0 && gray_level(0, 0, 0, 1) == 3, "Color(r, g, b) white, black");
+  CHECK(gray_level(85, 85, 85, 255) == 2 && gray_level(170, 170, 170, 255) == 1, "gray steps");
+  for (int v = 1; v < 255; v++)
+    CHECK(gray_level(v, v, v, 255) <= gray_level(v - 1, v - 1, v - 1, 255), "gray_level non-increasing at %d", v);
+}
+
+void test_pack_rows() {
+  uint8_t row[2 * 32], out[32], high[32];
+  for (int trial = 0; trial < 2000; trial++) {
+    const size_t len = random_below(32) + 1;
+    for (uint8_t &b : row)
+      b = random_below(256);
+    const uint8_t invert = trial & 1 ? 0xFF : 0x00;
+    const bool reversed = trial & 2;
+  
+    pack_plane_row(out, row, len, invert, reversed);
+    for (size_t i = 0; i < len; i++) {
+      uint8_t expected = (reversed ? naive_reverse(row[i]) : row[i]) ^ invert;
+      CHECK(out[i] == expected, "pack_plane_row byte %zu of %zu", i, len);
+    }
+  
+    pack_gray_row(out, high, row, len, reversed);
+    for (size_t i = 0; i < len; i++) {
+      const uint16_t planes = naive_gray_planes(row[2 * i], row[2 * i + 1]);
+      const uint8_t low_plane = planes & 0xFF;
+      const uint8_t high_plane = planes >> 8;
+      CHECK(out[i] == (reversed ? naive_reverse(low_plane) : low_plane), "pack_gray_row low byte %zu of %zu", i,
+            len);
+      CHECK(high[i] == (reversed ? naive_reverse(high_plane) : high_plane), "pack_gray_row high byte %zu of %zu", i,
+            len);
+    }
+  }
+}
+
+}  // namespace
+
+int main() {
+  for (const PanelGeometry &panel : PANEL_GEOMETRIES) {
+    const Geometry geometry(panel);
+    test_pixels(geometry);
+    test_diff_rows(geometry);
+    test_split_regions(geometry);
+    test_frame_writes(geometry, false, STAGING_BYTES);
+    test_frame_writes(geometry, true, STAGING_BYTES);
+    // Staging smaller than two rows, every step sends one row
+    test_frame_writes(geometry, false, geometry.row_bytes() + 3);
+    test_frame_formats(geometry);
+  }
+  test_controller_state();
+  test_persistent_init();
+  test_set_ram_window();
+  test_transpose8();
+  test_bits();
+  test_pack_rows();
+  
+  printf("%d checks, %d failures\n", checks, failures);
+  return failures == 0 ? 0 : 1;
+}